@@ -40,12 +40,107 @@
 #define ADDR_LY 0xFF44
 #define ADDR_LYC 0xFF45
 #define ADDR_DMA_TRANSFER 0xFF46
+#define ADDR_BGP 0xFF47
+#define ADDR_OBP0 0xFF48
+#define ADDR_OBP1 0xFF49
 #define ADDR_WY 0xFF4A
-#define ADDR_WX 0xFF48 // window.x - 7
+#define ADDR_WX 0xFF4B // window.x - 7
 #define ADDR_KEY1 0xFF4D
+#define ADDR_VBK 0xFF4F
+#define ADDR_HDMA1 0xFF51
+#define ADDR_HDMA2 0xFF52
+#define ADDR_HDMA3 0xFF53
+#define ADDR_HDMA4 0xFF54
+#define ADDR_HDMA5 0xFF55
+#define ADDR_SVBK 0xFF70
 
-void bus_init(const cart_context* cart_ctx);
-u8 bus_read(u16 addr);
-u16 bus_read16(u16 addr);
-void bus_write(u16 addr, u8 val);
-void bus_write16(u16 addr, u16 val);
+// the address space is split into 256-byte pages; plain memory pages hold a
+// host pointer and are accessed with a single table lookup, NULL pages fall
+// through to the page's handler (MBC control, OAM, I/O registers)
+#define BUS_PAGE_SIZE 0x100
+#define BUS_PAGE_COUNT 0x100
+#define BUS_PAGE(addr) ((addr) >> 8)
+
+// page traps force a page off the fast path so accesses can be intercepted
+// without a check on plain memory; the trapped access then goes to the
+// page's backing memory or handler unless a trap claims it
+#define BUS_TRAP_DMA 0x01 // oam dma running, the cpu only sees 0xFF00-0xFFFF
+#define BUS_TRAP_WATCH_READ 0x02
+#define BUS_TRAP_WATCH_WRITE 0x04
+#define BUS_TRAP_WATCH_EXEC 0x08
+#define BUS_TRAP_PROFILE 0x10 // count every access
+#define BUS_TRAP_TILES 0x20 // vram tile data, writes update the decoded tile cache
+#define BUS_TRAP_PPU 0x40 // vram and oam, writes first bring the ppu's lazy rendering up to date
+// traps taking a page off the read or write fast path
+#define BUS_TRAPS_READ (BUS_TRAP_DMA | BUS_TRAP_WATCH_READ | BUS_TRAP_WATCH_EXEC | BUS_TRAP_PROFILE)
+#define BUS_TRAPS_WRITE (BUS_TRAP_DMA | BUS_TRAP_WATCH_WRITE | BUS_TRAP_PROFILE | BUS_TRAP_TILES | BUS_TRAP_PPU)
+// traps that must see every instruction fetch, the cpu doesn't cache there
+#define BUS_TRAPS_FETCH (BUS_TRAP_WATCH_EXEC | BUS_TRAP_PROFILE)
+
+typedef u8 (*bus_read_handler)(gbc_machine *gb, u16 addr);
+typedef void (*bus_write_handler)(gbc_machine *gb, u16 addr, u8 val);
+
+typedef struct {
+	u32 rom_bank[2]; // banks mapped at 0x0000 and 0x4000
+	u32 vram_bank;
+	u32 wram_bank;
+	bool cgb; // cartridge flags cgb support, enables vram/wram banking
+	u8 *mem;
+	const u8 *rom; // banked rom, the cartridge's read-only mapping
+	u32 rom_size;
+	u8 *vram; // banked vram, 2 banks on cgb
+	u8 *wram; // banked wram, 8 banks on cgb
+
+	// page tables, read_map/write_map are what the cpu sees: the backing
+	// pages with trapped pages cleared
+	u8 *read_map[BUS_PAGE_COUNT];
+	u8 *write_map[BUS_PAGE_COUNT];
+	u8 *read_pages[BUS_PAGE_COUNT];
+	u8 *write_pages[BUS_PAGE_COUNT];
+	u8 traps[BUS_PAGE_COUNT];
+	bus_read_handler read_handlers[BUS_PAGE_COUNT];
+	bus_write_handler write_handlers[BUS_PAGE_COUNT];
+	// 0xFF00-0xFF7F register handlers, registered by the subsystems at init
+	bus_read_handler io_read[0x80];
+	bus_write_handler io_write[0x80];
+	u8 open_bus[BUS_PAGE_SIZE]; // reads as 0xFF, backs pages past the end of the rom
+} bus_ctx;
+
+void bus_init(gbc_machine *gb, const cart_context* cart_ctx);
+void bus_shutdown(gbc_machine *gb);
+// repoint a 16 KiB rom window (0x0000 or 0x4000) at a rom bank
+void bus_map_rom_bank(gbc_machine *gb, u16 window, u32 bank);
+// repoint 0xA000-0xBFFF at 8 KiB of cart ram, NULL routes accesses to the mbc
+void bus_map_cart_ram(gbc_machine *gb, u8 *read, u8 *write);
+// repoint the write side of the page containing addr, NULL routes it to the handler
+void bus_map_write_page(gbc_machine *gb, u16 addr, u8 *write);
+// host pointer to the plain memory page holding addr, NULL if it has a handler;
+// ignores traps, for dma engines that bypass the cpu's view of the bus
+const u8 *bus_read_page(gbc_machine *gb, u16 addr);
+// copy len bytes within one page from another bus master (hdma), bypassing
+// the cpu's dma window but keeping watchpoints and the tile cache informed
+void bus_dma_write(gbc_machine *gb, u16 addr, const u8 *src, u32 len);
+// read for another bus master, through handlers and watchpoints but not
+// blocked by the cpu's dma window
+u8 bus_dma_read(gbc_machine *gb, u16 addr);
+// oam lives behind a handler (0xFEA0-0xFEFF is unusable), oam dma copies here
+u8 *bus_oam(gbc_machine *gb);
+// set or clear a trap on the pages covering start-end
+void bus_set_trap(gbc_machine *gb, u16 start, u16 end, u8 trap, bool on);
+u8 bus_page_traps(gbc_machine *gb, u16 addr);
+// claim an i/o register, NULL handlers fall back to plain memory
+void bus_register_io(gbc_machine *gb, u16 addr, bus_read_handler read, bus_write_handler write);
+// plain memory access to i/o registers, for handlers that only filter values
+u8 bus_io_read_mem(gbc_machine *gb, u16 addr);
+void bus_io_write_mem(gbc_machine *gb, u16 addr, u8 val);
+u32 bus_rom_bank(gbc_machine *gb, u16 addr);
+u8 bus_read(gbc_machine *gb, u16 addr);
+// opcode fetch, like bus_read but reports to exec watchpoints instead
+u8 bus_fetch(gbc_machine *gb, u16 addr);
+u16 bus_read16(gbc_machine *gb, u16 addr);
+void bus_write(gbc_machine *gb, u16 addr, u8 val);
+void bus_write16(gbc_machine *gb, u16 addr, u16 val);
+// time a mixed read workload through the page tables against an address
+// range decode chain over the same memory, and bus_read16/bus_write16
+// against byte pairs
+void bus_benchmark(gbc_machine *gb);
@@ -25,11 +25,13 @@ typedef struct {
 typedef struct {
 	const char *filepath;
 	u32 rom_size;
-	u8 *rom_data;
-	rom_header *header;
+	const u8 *rom_data; // mmap'ed read-only, or a heap copy for unmappable files
+	const rom_header *header;
+	bool mapped;
 } cart_context;
 
-cart_context *get_cart_context();
-bool cart_init(const char *cart_filepath);
-u8 cart_read(u16 addr);
-void cart_debug();
+cart_context *get_cart_context(gbc_machine *gb);
+bool cart_init(gbc_machine *gb, const char *cart_filepath);
+u8 cart_read(gbc_machine *gb, u16 addr);
+void cart_debug(gbc_machine *gb);
+void cart_shutdown(gbc_machine *gb);
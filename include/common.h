@@ -10,6 +10,16 @@ typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
+typedef int64_t i64;
+
+// every subsystem api takes the machine it operates on, see gbc.h
+typedef struct gbc_machine gbc_machine;
+
+#if defined(_MSC_VER)
+#define ALWAYS_INLINE __forceinline
+#else
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#endif
 
 #define BIT(a, n) ((a & (1 << n)) ? 1 : 0)
 #define BETWEEN(a, b, c) ((a >= b) && (a <= c))
@@ -34,8 +44,18 @@ typedef uint64_t u64;
 #define ADDR_LY 0xFF44
 #define ADDR_LYC 0xFF45
 #define ADDR_DMA_TRANSFER 0xFF46
+#define ADDR_BGP 0xFF47
+#define ADDR_OBP0 0xFF48
+#define ADDR_OBP1 0xFF49
 #define ADDR_WY 0xFF4A
-#define ADDR_WX 0xFF48
+#define ADDR_WX 0xFF4B
 #define ADDR_KEY1 0xFF4D
+#define ADDR_VBK 0xFF4F
+#define ADDR_HDMA1 0xFF51
+#define ADDR_HDMA2 0xFF52
+#define ADDR_HDMA3 0xFF53
+#define ADDR_HDMA4 0xFF54
+#define ADDR_HDMA5 0xFF55
+#define ADDR_SVBK 0xFF70
 
 #define ADDR_IE 0xFFFF
@@ -14,6 +14,46 @@ typedef union {
 	} bytes;
 } r16;
 
+#define CPU_DECODE_CACHE_SIZE 0x8000
+
+typedef void (*cpu_op_handler)(gbc_machine *gb);
+
+typedef enum {
+	CPU_DISPATCH_THREADED, // per-opcode handler table
+	CPU_DISPATCH_SWITCH,   // generic switch interpreter
+} cpu_dispatch_mode;
+
+// instruction decoded once with its immediate operand bytes, cached per
+// (rom bank, PC) for code running from rom
+typedef struct {
+	const cpu_instruction *instruction;
+	cpu_op_handler handler;
+	u16 imm;
+	u16 bank_tag; // rom bank + 1, 0 when not cached
+	u16 pc;
+	u8 opcode;
+	u8 length;
+} cpu_decoded_instruction;
+
+typedef enum {
+	CPU_LAZY_NONE, // F holds the current flags
+	CPU_LAZY_ADD,
+	CPU_LAZY_ADC,
+	CPU_LAZY_SUB, // SUB, CP
+	CPU_LAZY_SBC,
+	CPU_LAZY_INC,
+	CPU_LAZY_DEC,
+} cpu_lazy_op;
+
+// operands of the last 8-bit ALU operation, Z/N/H/C are only computed into F
+// when something reads the flags (register accessors included)
+typedef struct {
+	cpu_lazy_op op;
+	u16 a; // operand, or the result for inc/dec
+	u16 b;
+	bool c; // carry in for adc/sbc, carried over C for inc/dec
+} cpu_lazy_flags;
+
 typedef struct {
 	struct {
 		r16 AF;
@@ -23,21 +63,41 @@ typedef struct {
 		u16 PC;
 		u16 SP;
 	} registers;
+	cpu_lazy_flags lazy_flags;
+	cpu_dispatch_mode dispatch_mode;
 	bool halted;
 	bool stopped;
-	u32 cycles;
+	u32 cycles; // cycles of the current step
+	u64 ticks;  // cycles since power on
+	bool yield; // end the current cpu_run_until batch early
 	// instruction state
 	u8 current_opcode;
-	cpu_instruction current_instruction;
+	const cpu_instruction *current_instruction;
+	const cpu_decoded_instruction *decoded;
 	u16 fetched_data;
-	bool write_bus;
+	bool write_bus; // write_dst holds a bus address (which may be 0x0000)
 	u16 write_dst;
 	// interrupts
 	bool ime;
 	bool enable_ime;
+	// decoded instructions for 0x0000-0x7FFF, code elsewhere uses the scratch entry
+	cpu_decoded_instruction decode_cache[CPU_DECODE_CACHE_SIZE];
+	cpu_decoded_instruction decode_scratch;
 } cpu_context;
 
-void cpu_init();
-void cpu_debug();
-u32 cpu_step();
-void cpu_request_interrupt(u8 interrupt);
+void cpu_init(gbc_machine *gb);
+void cpu_debug(gbc_machine *gb);
+void cpu_set_dispatch_mode(gbc_machine *gb, cpu_dispatch_mode mode);
+u32 cpu_step(gbc_machine *gb);
+// run instructions until target_cycle is reached or cpu_yield(gb) is called,
+// returns the cycles consumed
+u32 cpu_run_until(gbc_machine *gb, u64 target_cycle);
+void cpu_yield(gbc_machine *gb);
+// halt the cpu for cycles while another bus master (dma) works
+void cpu_stall(gbc_machine *gb, u32 cycles);
+u64 cpu_get_ticks(gbc_machine *gb);
+// address of the instruction being executed
+u16 cpu_instruction_pc(gbc_machine *gb);
+// drop all cached decoded instructions
+void cpu_flush_decode_cache(gbc_machine *gb);
+void cpu_request_interrupt(gbc_machine *gb, u8 interrupt);
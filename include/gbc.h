@@ -1,7 +1,23 @@
+#pragma once
+
 #include <stdint.h>
 #include <stdbool.h>
 
 #include <common.h>
+#include <bus.h>
+#include <cart.h>
+#include <cpu.h>
+#include <hdma.h>
+#include <mbc.h>
+#include <pixel.h>
+#include <ppu.h>
+#include <profile.h>
+#include <rtc.h>
+#include <scheduler.h>
+#include <serial.h>
+#include <tiles.h>
+#include <timer.h>
+#include <watch.h>
 
 typedef struct {
 	bool debug_mode;
@@ -12,6 +28,46 @@ typedef struct {
 	u64 cycles;
 } gbc_context;
 
-gbc_context* gbc_get_context();
+// one emulated system, owns the state of every subsystem so any number of
+// machines can run side by side (one thread per machine at a time)
+struct gbc_machine {
+	gbc_context gbc;
+	cart_context cart;
+	bus_ctx bus;
+	mbc_context mbc;
+	rtc_context rtc;
+	cpu_context cpu;
+	scheduler_context scheduler;
+	timer_context timer;
+	serial_context serial;
+	ppu_context ppu;
+	hdma_context hdma;
+	watch_context watch;
+	profile_context profile;
+	tiles_context tiles;
+};
+
+typedef struct {
+	bool headless;   // run without SDL on the calling thread
+	bool trace;      // print cpu state before every instruction
+	bool switch_dispatch; // use the switch interpreter instead of the handler table
+	bool rtc_cycles; // drive the cartridge clock from emulated cycles, for replays
+	u64 frames;      // headless: stop after this many frames, 0 for no limit
+	u64 cycles;      // headless: stop after this many cycles, 0 for no limit
+	const char *dump_path; // headless: framebuffer output, .ppm or raw indices
+	u32 dump_every;  // headless: also dump every nth frame, 0 for final only
+	watch_range watches[WATCH_MAX]; // watchpoints logged to stderr
+	u32 watch_count;
+	const char *profile_path; // count memory traffic, csv written on exit
+	bool bench_bus;  // time bus accesses on the loaded rom instead of running it
+} gbc_options;
+
+// load a rom into a new machine and power it on, NULL on failure
+gbc_machine *gbc_machine_create(const char *rom_filepath);
+void gbc_machine_destroy(gbc_machine *gb);
+// run the cpu up to the next hardware event (but not past limit) and dispatch it
+void gbc_machine_step(gbc_machine *gb, u64 limit);
+
+gbc_context* gbc_get_context(gbc_machine *gb);
 
-int gbc_run(const char *rom_filepath);
+int gbc_run(const char *rom_filepath, const gbc_options *options);
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "common.h"
 
 typedef enum {
@@ -5,7 +7,7 @@ typedef enum {
 	GUI_QUIT,
 } gui_event;
 
-void gui_init();
+void gui_init(gbc_machine *gb);
 void gui_shutdown();
 void gui_tick();
 gui_event gui_handle_input();
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "common.h"
+
+// cgb vram dma, general purpose (all at once) or one 16 byte block per h-blank
+typedef struct {
+	u16 src;
+	u16 dst;       // offset into vram
+	u8 blocks;     // 16 byte blocks left of an h-blank transfer
+	bool active;   // h-blank transfer in progress
+} hdma_context;
+
+void hdma_init(gbc_machine *gb);
+// called by the ppu when a visible line enters h-blank
+void hdma_hblank(gbc_machine *gb);
@@ -1,3 +1,5 @@
+#pragma once
+
 typedef enum {
 	INTERRUPT_NONE = 0x0,
 	INTERRUPT_VBLANK = 0x1,
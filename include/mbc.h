@@ -0,0 +1,52 @@
+#pragma once
+
+#include "common.h"
+#include "cart.h"
+
+typedef enum {
+	MBC_NONE, // rom only, optionally with plain ram
+	MBC_1,
+	MBC_2,
+	MBC_3,
+	MBC_5,
+	MBC_COUNT,
+} mbc_type;
+
+#define MBC_RAM_MAX_SIZE 0x20000
+#define MBC_RAM_PAGES (MBC_RAM_MAX_SIZE / 0x100)
+#define MBC_RAM_UNMAPPED UINT32_MAX
+
+// memory bank controller state, bank switches only repoint the bus windows
+typedef struct {
+	mbc_type type;
+	bool has_ram;
+	bool has_battery;
+	bool has_rtc;
+	u32 rom_banks;
+	u32 ram_banks;
+	u32 ram_size;
+	u8 *ram;
+	bool ram_enabled;
+	u32 ram_offset; // offset of the bank mapped at 0xA000, MBC_RAM_UNMAPPED if none
+	// battery backed ram is a shared mapping of the .sav file next to the rom.
+	// clean pages are write protected in the page table, the first store to
+	// a page marks it dirty and maps it writable, dirty pages are msync'ed
+	// asynchronously once a frame and protected again
+	char *save_path;
+	bool save_mapped;
+	u64 save_dirty[MBC_RAM_PAGES / 64];
+	// bank registers as written by the game
+	u16 rom_bank;  // mbc1: lower 5 bits, mbc5: 9 bits
+	u8 bank_hi;    // mbc1: 2-bit upper rom / ram bank
+	u8 ram_bank;   // mbc3: ram bank or rtc register select, mbc5: ram bank
+	u8 mode;       // mbc1: banking mode
+} mbc_context;
+
+void mbc_init(gbc_machine *gb, const cart_context *cart_ctx);
+// write the battery ram back to the .sav file and release it
+void mbc_shutdown(gbc_machine *gb);
+// writes to 0x0000-0x7FFF
+void mbc_write(gbc_machine *gb, u16 addr, u8 val);
+// accesses to 0xA000-0xBFFF while it isn't mapped to plain ram
+u8 mbc_ram_read(gbc_machine *gb, u16 addr);
+void mbc_ram_write(gbc_machine *gb, u16 addr, u8 val);
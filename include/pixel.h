@@ -0,0 +1,21 @@
+#pragma once
+
+#include "common.h"
+
+// identity palette, color index n maps to shade n
+#define PIXEL_PALETTE_IDENTITY 0xE4
+
+// 2bpp pixel kernels, the best set for the host cpu is picked at runtime
+typedef struct {
+	const char *name;
+	// rows of two bitplane bytes to eight palette mapped indices each,
+	// leftmost pixel first in out and last in flipped (either may be NULL)
+	void (*decode)(const u8 *data, u32 rows, u8 palette, u8 *out, u8 *flipped);
+	// map count color indices through a bgp/obp style palette
+	void (*shade)(const u8 *in, u8 *out, u32 count, u8 palette);
+} pixel_kernels;
+
+// fastest kernels the cpu supports, GBC_PIXEL_KERNELS=<name> forces a set
+const pixel_kernels *pixel_get_kernels(void);
+// time every supported set against the scalar one and check they agree
+void pixel_benchmark(void);
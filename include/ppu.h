@@ -1,5 +1,10 @@
+#pragma once
+
 #include "common.h"
 
+#define PPU_SCREEN_WIDTH 160
+#define PPU_SCREEN_HEIGHT 144
+
 typedef struct {
 	u8 y;
 	u8 x;
@@ -7,7 +12,36 @@ typedef struct {
 	u8 flags;
 } oam_entry;
 
-void ppu_init();
-void ppu_tick();
-void ppu_dma_start(u8 addr);
-bool ppu_dma_is_transferring();
+typedef enum {
+	PPU_MODE_HBLANK,
+	PPU_MODE_VBLANK,
+	PPU_MODE_OAM,
+	PPU_MODE_DRAW,
+} ppu_mode;
+
+typedef struct {
+	u16 oam_src;
+	ppu_mode mode; // as of the last mode event
+	u8 ly;
+	bool lcd_on;
+	bool stat_line; // or of the enabled stat interrupt sources
+	u64 frame_start; // cycle line 0 began
+	u8 rendered_lines; // lines of this frame already in the framebuffer
+	u64 frames;
+	u8 window_line; // window rows drawn this frame
+	u8 framebuffer[PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT]; // shade index per pixel
+} ppu_context;
+
+void ppu_init(gbc_machine *gb);
+void ppu_lcdc_write(gbc_machine *gb, u8 val);
+void ppu_dma_start(gbc_machine *gb, u8 addr);
+bool ppu_dma_is_transferring(gbc_machine *gb);
+ppu_mode ppu_get_mode(gbc_machine *gb);
+u64 ppu_get_frame_count(gbc_machine *gb);
+// render the lines whose h-blank has begun, before anything they read changes
+void ppu_catch_up(gbc_machine *gb);
+// brought up to date first, so only call it from the emulation thread
+const u8 *ppu_get_framebuffer(gbc_machine *gb);
+
+// argb colors for the four dmg shades, shared by the gui and frame dumps
+extern const u32 ppu_shade_colors[4];
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+
+#define PROFILE_ROM_BANKS 512 // mbc5 maximum
+#define PROFILE_RAM_BANKS 16
+#define PROFILE_WRAM_BANKS 8
+#define PROFILE_VRAM_BANKS 2
+
+typedef enum {
+	PROFILE_READ,
+	PROFILE_WRITE,
+	PROFILE_FETCH,
+	PROFILE_SWITCH, // bank mapped in, banks only
+	PROFILE_COUNTER_COUNT,
+} profile_counter;
+
+typedef enum {
+	PROFILE_BANK_ROM,
+	PROFILE_BANK_RAM,
+	PROFILE_BANK_WRAM,
+	PROFILE_BANK_VRAM,
+} profile_bank;
+
+// memory traffic counters. profiling traps every page, so accesses leave the
+// page table fast path and are counted on the trapped path; with profiling
+// off nothing is trapped and nothing is counted
+typedef struct {
+	bool enabled;
+	const char *csv_path; // written by profile_dump, NULL for none
+	u64 pages[0x100][PROFILE_COUNTER_COUNT];
+	u64 rom_banks[PROFILE_ROM_BANKS][PROFILE_COUNTER_COUNT];
+	u64 ram_banks[PROFILE_RAM_BANKS][PROFILE_COUNTER_COUNT];
+	u64 wram_banks[PROFILE_WRAM_BANKS][PROFILE_COUNTER_COUNT];
+	u64 vram_banks[PROFILE_VRAM_BANKS][PROFILE_COUNTER_COUNT];
+} profile_context;
+
+void profile_init(gbc_machine *gb);
+// start counting, csv_path receives the counters when the machine is destroyed
+void profile_enable(gbc_machine *gb, const char *csv_path);
+// called by the bus for every access while profiling
+void profile_access(gbc_machine *gb, profile_counter counter, u16 addr);
+// a bank was mapped in, counted whether or not profiling is enabled
+void profile_switch(gbc_machine *gb, profile_bank bank, u32 index);
+void profile_dump(gbc_machine *gb);
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "common.h"
+
+// size of the clock state appended to the .sav file, the common vba layout:
+// 5 current + 5 latched registers as u32 le, then a u64 le unix timestamp
+#define RTC_SAVE_SIZE 48
+
+typedef enum {
+	RTC_CLOCK_HOST,   // wall clock, keeps running while the emulator is closed
+	RTC_CLOCK_CYCLES, // emulated cycles, deterministic for replays
+} rtc_clock;
+
+// mbc3 real-time clock. nothing ticks: the counter is kept as the clock
+// time it started from and only turned into registers when latched or written
+typedef struct {
+	rtc_clock clock;
+	i64 base;     // clock seconds at which the counter read 0
+	u64 halted;   // counter value while halted
+	bool halt;
+	bool carry;   // day counter overflow, sticky until written
+	u8 latched[5];
+	u8 latch_prev;
+	// state loaded from the save, the counter is (re)started from it
+	u64 save_counter;
+	i64 save_time;
+} rtc_context;
+
+void rtc_init(gbc_machine *gb);
+// pick the time source, before the machine starts running
+void rtc_set_clock(gbc_machine *gb, rtc_clock clock);
+// writes to 0x6000-0x7FFF, 0 then 1 copies the counter into the registers
+void rtc_latch(gbc_machine *gb, u8 val);
+// register 0x08-0x0C as selected through 0x4000-0x5FFF
+u8 rtc_read(gbc_machine *gb, u8 reg);
+void rtc_write(gbc_machine *gb, u8 reg, u8 val);
+void rtc_load(gbc_machine *gb, const u8 *data, u32 size);
+void rtc_save(gbc_machine *gb, u8 data[RTC_SAVE_SIZE]);
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+// hardware events ordered by the cycle they are due, the cpu runs freely
+// until the earliest one
+typedef enum {
+	SCHED_TIMER,
+	SCHED_PPU_MODE,
+	SCHED_OAM_DMA,
+	SCHED_SERIAL,
+	SCHED_FRAME_END,
+	SCHED_SAVE_SYNC,
+	SCHED_EVENT_COUNT,
+} sched_event;
+
+#define SCHED_NEVER UINT64_MAX
+
+// called with the cycle the event was scheduled for
+typedef void (*sched_callback)(gbc_machine *gb, u64 cycle);
+
+// binary min-heap of pending events, one slot per event type
+typedef struct {
+	u64 when[SCHED_EVENT_COUNT];
+	sched_callback callbacks[SCHED_EVENT_COUNT];
+	int pos[SCHED_EVENT_COUNT]; // heap index, -1 when not scheduled
+	sched_event heap[SCHED_EVENT_COUNT];
+	int count;
+} scheduler_context;
+
+void scheduler_init(gbc_machine *gb);
+void scheduler_register(gbc_machine *gb, sched_event event, sched_callback callback);
+// (re)schedule event at an absolute cycle
+void scheduler_schedule(gbc_machine *gb, sched_event event, u64 cycle);
+void scheduler_cancel(gbc_machine *gb, sched_event event);
+bool scheduler_pending(gbc_machine *gb, sched_event event);
+u64 scheduler_next(gbc_machine *gb);
+// dispatch every event due at or before now
+void scheduler_run(gbc_machine *gb, u64 now);
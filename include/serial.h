@@ -0,0 +1,12 @@
+#pragma once
+
+#include "common.h"
+
+typedef struct {
+	u8 sb;
+	u8 sc;
+} serial_context;
+
+void serial_init(gbc_machine *gb);
+u8 serial_read(gbc_machine *gb, u16 addr);
+void serial_write(gbc_machine *gb, u16 addr, u8 val);
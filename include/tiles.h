@@ -0,0 +1,26 @@
+#pragma once
+
+#include "common.h"
+#include "pixel.h"
+
+#define TILES_PER_BANK 384
+#define TILES_MAX (TILES_PER_BANK * 2) // cgb has a second vram bank
+
+// tile data (0x8000-0x97FF of both vram banks) decoded to one color index
+// per byte, plus a horizontally flipped copy for objects. vram writes reach
+// the cache through a write trap on the tile data pages and only redecode
+// the row they touched
+typedef struct {
+	u8 pixels[TILES_MAX][8][8];
+	u8 flipped[TILES_MAX][8][8];
+	const pixel_kernels *kernels;
+} tiles_context;
+
+void tiles_init(gbc_machine *gb);
+// tile data at addr (current vram bank) changed, len bytes from there
+void tiles_write(gbc_machine *gb, u16 addr, u32 len);
+
+// row of a tile, index counts from the start of bank 0 tile data
+static inline const u8 *tiles_row(const tiles_context *ctx, u32 tile, u8 row, bool flip) {
+	return flip ? ctx->flipped[tile][row] : ctx->pixels[tile][row];
+}
@@ -1,7 +1,19 @@
+#pragma once
+
 #include "common.h"
 
-void timer_init();
-// tick timer and return whether to request interrupt
-bool timer_tick();
-u8 timer_read(u16 addr);
-void timer_write(u16 addr, u8 val);
+// the internal div counter advances 4 times per cpu cycle, DIV is its upper
+// byte and TIMA counts falling edges of the bit selected by TAC. both are
+// computed from the cycle counter when read, nothing runs per cycle.
+typedef struct {
+	u64 div_offset;   // div counter = cycles * 4 + div_offset
+	u64 tima_counter; // div counter value tima was last brought up to date at
+	u8 tima;
+	u8 tma;
+	u8 tac;
+} timer_context;
+
+
+void timer_init(gbc_machine *gb);
+u8 timer_read(gbc_machine *gb, u16 addr);
+void timer_write(gbc_machine *gb, u16 addr, u8 val);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+
+#define WATCH_MAX 16
+
+typedef enum {
+	WATCH_READ = 0x1,
+	WATCH_WRITE = 0x2,
+	WATCH_EXEC = 0x4,
+} watch_kind;
+
+typedef struct {
+	watch_kind kind;
+	u16 addr;
+	u16 pc;   // start of the instruction that made the access
+	u8 val;   // value read, written or the opcode executed
+	u64 cycle;
+} watch_hit;
+
+typedef void (*watch_callback)(gbc_machine *gb, const watch_hit *hit, void *user);
+
+typedef struct {
+	u16 start;
+	u16 end;
+	u8 kinds; // watch_kind bits, 0 for a free slot
+} watch_range;
+
+// memory watchpoints. watched pages are trapped in the bus page table, the
+// rest of memory keeps its fast path
+typedef struct {
+	watch_range ranges[WATCH_MAX];
+	watch_callback callback; // NULL logs hits to stderr
+	void *user;
+} watch_context;
+
+void watch_init(gbc_machine *gb);
+// watch start-end (inclusive) for kinds, returns the watchpoint id or -1
+int watch_add(gbc_machine *gb, u16 start, u16 end, u8 kinds);
+void watch_remove(gbc_machine *gb, int id);
+void watch_set_callback(gbc_machine *gb, watch_callback callback, void *user);
+// called by the bus for accesses to trapped pages
+void watch_check(gbc_machine *gb, watch_kind kind, u16 addr, u8 val);
@@ -1,11 +1,16 @@
 #include "bus.h"
+#include "gbc.h"
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include <cart.h>
+#include <mbc.h>
 #include <ppu.h>
-#include <timer.h>
+#include <profile.h>
+#include <tiles.h>
+#include <watch.h>
 
 // 16-bit address bus
 // 0x0000-0x7FFF 	 : PROGRAM DATA
@@ -30,240 +35,534 @@
 #define ROM_BANK_SIZE 0x4000
 #define RAM_BANK_SIZE 0x2000
 #define VRAM_BANK_SIZE 0x2000
+#define WRAM_BANK_SIZE 0x1000
+#define CGB_VRAM_BANKS 2
+#define CGB_WRAM_BANKS 8
 
-typedef struct {
-	u32 rom_bank;
-	u32 ram_bank;
-	u32 vram_bank;
-	u8 *mem;
-	u8 *rom;  // banked rom
-	u8 *ram;  // banked ram
-	u8 *vram; // banked vram
-	bool ram_enabled;
-	bool dma_transfer;
-} bus_ctx;
-
-static bus_ctx ctx = { 0 };
-
-void bus_init(const cart_context* cart_ctx) {
+
+static u8 bus_read_unmapped(gbc_machine *gb, u16 addr) {
+	printf("ERR: bus_read not supported at address: %02X\n", addr);
+	return 0x0;
+}
+
+static void bus_write_unmapped(gbc_machine *gb, u16 addr, u8 val) {
+	//printf("ERR: bus_write not supported at address: %02X\n", addr);
+}
+
+static void bus_write_mbc(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_write(gb, addr, val);
+}
+
+static u8 bus_read_cart_ram(gbc_machine *gb, u16 addr) {
+	return mbc_ram_read(gb, addr);
+}
+
+static void bus_write_cart_ram(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_ram_write(gb, addr, val);
+}
+
+static u8 bus_read_oam(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	// 0xFE00 - 0xFE9F, blocked by BUS_TRAP_DMA during oam dma
+	if (addr < 0xFEA0)
+		return ctx->mem[addr];
+
+	// 0xFEA0 - 0xFEFF
+	// RESERVED / UNUSABLE
+	return 0x0;
+}
+
+static void bus_write_oam(gbc_machine *gb, u16 addr, u8 val) {
+	bus_ctx *ctx = &gb->bus;
+	if (addr < 0xFEA0)
+		ctx->mem[addr] = val;
+}
+
+u8 bus_io_read_mem(gbc_machine *gb, u16 addr) {
+	return gb->bus.mem[addr];
+}
+
+void bus_io_write_mem(gbc_machine *gb, u16 addr, u8 val) {
+	gb->bus.mem[addr] = val;
+}
+
+void bus_register_io(gbc_machine *gb, u16 addr, bus_read_handler read, bus_write_handler write) {
+	bus_ctx *ctx = &gb->bus;
+	ctx->io_read[addr & 0x7F] = read ? read : bus_io_read_mem;
+	ctx->io_write[addr & 0x7F] = write ? write : bus_io_write_mem;
+}
+
+static u8 bus_read_io(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	if (addr >= 0xFF80) {
+		// high ram / ie
+		return ctx->mem[addr];
+	}
+	return ctx->io_read[addr & 0x7F](gb, addr);
+}
+
+static void bus_write_io(gbc_machine *gb, u16 addr, u8 val) {
+	bus_ctx *ctx = &gb->bus;
+	if (addr >= 0xFF80) {
+		// high ram / ie
+		ctx->mem[addr] = val;
+		return;
+	}
+	ctx->io_write[addr & 0x7F](gb, addr, val);
+}
+
+// publish a page's backing pointers to the cpu's view unless it is trapped
+static inline void bus_update_page(bus_ctx *ctx, u32 page) {
+	ctx->read_map[page] = (ctx->traps[page] & BUS_TRAPS_READ) ? NULL : ctx->read_pages[page];
+	ctx->write_map[page] = (ctx->traps[page] & BUS_TRAPS_WRITE) ? NULL : ctx->write_pages[page];
+}
+
+static void bus_map(gbc_machine *gb, u16 start, u16 end, u8 *read, u8 *write, bus_read_handler read_handler, bus_write_handler write_handler) {
+	bus_ctx *ctx = &gb->bus;
+	for (u32 page = BUS_PAGE(start); page <= BUS_PAGE(end); page++) {
+		u32 offset = (page - BUS_PAGE(start)) * BUS_PAGE_SIZE;
+		ctx->read_pages[page] = read ? read + offset : NULL;
+		ctx->write_pages[page] = write ? write + offset : NULL;
+		ctx->read_handlers[page] = read_handler;
+		ctx->write_handlers[page] = write_handler;
+		bus_update_page(ctx, page);
+	}
+}
+
+// point start-end at data without touching the handlers
+static void bus_repoint(gbc_machine *gb, u16 start, u16 end, u8 *data) {
+	bus_ctx *ctx = &gb->bus;
+	for (u32 page = BUS_PAGE(start); page <= BUS_PAGE(end); page++, data += BUS_PAGE_SIZE) {
+		ctx->read_pages[page] = data;
+		ctx->write_pages[page] = data;
+		bus_update_page(ctx, page);
+	}
+}
+
+static void bus_map_vram_bank(gbc_machine *gb, u32 bank) {
+	bus_ctx *ctx = &gb->bus;
+	if (bank != ctx->vram_bank)
+		profile_switch(gb, PROFILE_BANK_VRAM, bank);
+	ctx->vram_bank = bank;
+	bus_repoint(gb, 0x8000, 0x9FFF, ctx->vram + bank * VRAM_BANK_SIZE);
+}
+
+static void bus_map_wram_bank(gbc_machine *gb, u32 bank) {
+	bus_ctx *ctx = &gb->bus;
+	if (bank != ctx->wram_bank)
+		profile_switch(gb, PROFILE_BANK_WRAM, bank);
+	ctx->wram_bank = bank;
+	u8 *data = ctx->wram + bank * WRAM_BANK_SIZE;
+	bus_repoint(gb, 0xD000, 0xDFFF, data);
+	// echo of the switchable bank, up to the oam
+	bus_repoint(gb, 0xF000, 0xFDFF, data);
+}
+
+static u8 bus_read_vbk(gbc_machine *gb, u16 addr) {
+	return 0xFE | gb->bus.vram_bank;
+}
+
+static void bus_write_vbk(gbc_machine *gb, u16 addr, u8 val) {
+	bus_map_vram_bank(gb, val & 0x1);
+}
+
+static u8 bus_read_svbk(gbc_machine *gb, u16 addr) {
+	return 0xF8 | gb->bus.wram_bank;
+}
+
+static void bus_write_svbk(gbc_machine *gb, u16 addr, u8 val) {
+	// bank 0 selects bank 1
+	u32 bank = val & 0x7;
+	bus_map_wram_bank(gb, bank ? bank : 1);
+}
+
+void bus_map_rom_bank(gbc_machine *gb, u16 window, u32 bank) {
+	bus_ctx *ctx = &gb->bus;
+	u32 w = window / ROM_BANK_SIZE;
+	if (ctx->rom_bank[w] == bank)
+		return;
+
+	// a bank switch only rewrites the window's read pointers, the handlers
+	// stay the same; pages past the end of the rom read as open bus
+	ctx->rom_bank[w] = bank;
+	profile_switch(gb, PROFILE_BANK_ROM, bank);
+	u32 offset = bank * ROM_BANK_SIZE;
+	for (u32 page = BUS_PAGE(window); page < BUS_PAGE(window + ROM_BANK_SIZE); page++, offset += BUS_PAGE_SIZE) {
+		ctx->read_pages[page] = offset < ctx->rom_size ? (u8 *)ctx->rom + offset : ctx->open_bus;
+		bus_update_page(ctx, page);
+	}
+}
+
+void bus_map_cart_ram(gbc_machine *gb, u8 *read, u8 *write) {
+	bus_map(gb, 0xA000, 0xBFFF, read, write, bus_read_cart_ram, bus_write_cart_ram);
+}
+
+void bus_map_write_page(gbc_machine *gb, u16 addr, u8 *write) {
+	bus_ctx *ctx = &gb->bus;
+	ctx->write_pages[BUS_PAGE(addr)] = write;
+	bus_update_page(ctx, BUS_PAGE(addr));
+}
+
+const u8 *bus_read_page(gbc_machine *gb, u16 addr) {
+	return gb->bus.read_pages[BUS_PAGE(addr)];
+}
+
+u8 *bus_oam(gbc_machine *gb) {
+	return gb->bus.mem + ADDR_OAM;
+}
+
+void bus_set_trap(gbc_machine *gb, u16 start, u16 end, u8 trap, bool on) {
+	bus_ctx *ctx = &gb->bus;
+	for (u32 page = BUS_PAGE(start); page <= BUS_PAGE(end); page++) {
+		if (on)
+			ctx->traps[page] |= trap;
+		else
+			ctx->traps[page] &= ~trap;
+		bus_update_page(ctx, page);
+	}
+}
+
+u8 bus_page_traps(gbc_machine *gb, u16 addr) {
+	return gb->bus.traps[BUS_PAGE(addr)];
+}
+
+// what the page holds with its traps ignored
+static u8 bus_read_backing(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	u32 page = BUS_PAGE(addr);
+	if (ctx->read_pages[page])
+		return ctx->read_pages[page][addr & 0xFF];
+	return ctx->read_handlers[page](gb, addr);
+}
+
+// ignore masks traps that don't apply to the reader
+static u8 bus_read_trapped_ignoring(gbc_machine *gb, u16 addr, u8 ignore) {
+	bus_ctx *ctx = &gb->bus;
+	u8 traps = ctx->traps[BUS_PAGE(addr)] & ~ignore;
+	if (traps & BUS_TRAP_PROFILE)
+		profile_access(gb, PROFILE_READ, addr);
+	// the dma owns the bus, the cpu reads nothing useful
+	if (traps & BUS_TRAP_DMA)
+		return 0xFF;
+	u8 val = bus_read_backing(gb, addr);
+	if (traps & BUS_TRAP_WATCH_READ)
+		watch_check(gb, WATCH_READ, addr, val);
+	return val;
+}
+
+static u8 bus_read_trapped(gbc_machine *gb, u16 addr) {
+	return bus_read_trapped_ignoring(gb, addr, 0);
+}
+
+u8 bus_dma_read(gbc_machine *gb, u16 addr) {
+	return bus_read_trapped_ignoring(gb, addr, BUS_TRAP_DMA);
+}
+
+// ignore masks traps that don't apply to the writer
+static void bus_write_trapped_ignoring(gbc_machine *gb, u16 addr, u8 val, u8 ignore) {
+	bus_ctx *ctx = &gb->bus;
+	u32 page = BUS_PAGE(addr);
+	u8 traps = ctx->traps[page] & ~ignore;
+	if (traps & BUS_TRAP_PROFILE)
+		profile_access(gb, PROFILE_WRITE, addr);
+	if (traps & BUS_TRAP_DMA)
+		return;
+	if (traps & BUS_TRAP_WATCH_WRITE)
+		watch_check(gb, WATCH_WRITE, addr, val);
+	if (traps & BUS_TRAP_PPU)
+		ppu_catch_up(gb);
+	if (ctx->write_pages[page])
+		ctx->write_pages[page][addr & 0xFF] = val;
+	else
+		ctx->write_handlers[page](gb, addr, val);
+	if (traps & BUS_TRAP_TILES)
+		tiles_write(gb, addr, 1);
+}
+
+static void bus_write_trapped(gbc_machine *gb, u16 addr, u8 val) {
+	bus_write_trapped_ignoring(gb, addr, val, 0);
+}
+
+void bus_dma_write(gbc_machine *gb, u16 addr, const u8 *src, u32 len) {
+	bus_ctx *ctx = &gb->bus;
+	u32 page = BUS_PAGE(addr);
+	u8 *dst = ctx->write_pages[page];
+	if (!dst || (ctx->traps[page] & BUS_TRAP_WATCH_WRITE)) {
+		// byte by byte so handlers and watchpoints see it, but an oam dma
+		// only keeps the cpu off the bus, not the hdma
+		for (u32 i = 0; i < len; i++)
+			bus_write_trapped_ignoring(gb, addr + i, src[i], BUS_TRAP_DMA);
+		return;
+	}
+
+	if (ctx->traps[page] & BUS_TRAP_PPU)
+		ppu_catch_up(gb);
+	memcpy(dst + (addr & 0xFF), src, len);
+	if (ctx->traps[page] & BUS_TRAP_TILES)
+		tiles_write(gb, addr, len);
+}
+
+void bus_init(gbc_machine *gb, const cart_context* cart_ctx) {
+	bus_ctx *ctx = &gb->bus;
 	if (cart_ctx == NULL) {
 		printf("ERR: NO CART LOADED!\n");
 		return;
 	}
 
-	ctx.rom = calloc(1, cart_ctx->rom_size);
-	memcpy(ctx.rom, &cart_ctx->rom_data[0], cart_ctx->rom_size);
-
-	ctx.mem = calloc(1, MEM_SIZE);
-	memcpy(ctx.mem, &cart_ctx->rom_data[0], ROM_BANK_SIZE * 2);
-
-	int ram_bank_count = 0;
-	switch (cart_ctx->header->ram_size) {
-		case 0x2:
-			ram_bank_count = 1;
-		break;
-		case 0x3:
-			ram_bank_count = 4;
-		break;
-		case 0x4:
-			ram_bank_count = 16;
-		break;
-		case 0x5:
-			ram_bank_count = 8;
-		break;
-		default:
-			ram_bank_count = 0;
-		break;
+	// banks reference the cartridge data directly, nothing is copied
+	ctx->rom = cart_ctx->rom_data;
+	ctx->rom_size = cart_ctx->rom_size;
+	memset(ctx->open_bus, 0xFF, sizeof(ctx->open_bus));
+
+	ctx->mem = calloc(1, MEM_SIZE);
+
+	// cgb flag in the last byte of the title
+	ctx->cgb = cart_ctx->rom_data[0x143] & 0x80;
+	ctx->vram = calloc(ctx->cgb ? CGB_VRAM_BANKS : 1, VRAM_BANK_SIZE);
+	ctx->wram = calloc(ctx->cgb ? CGB_WRAM_BANKS : 2, WRAM_BANK_SIZE);
+
+	// rom windows, banked by the mbc
+	bus_map(gb, 0x0000, 0x7FFF, NULL, NULL, bus_read_unmapped, bus_write_mbc);
+	ctx->rom_bank[0] = ctx->rom_bank[1] = UINT32_MAX;
+	bus_map_rom_bank(gb, 0x0000, 0);
+	bus_map_rom_bank(gb, 0x4000, 1);
+	// LCD RAM, banked on cgb
+	bus_map(gb, 0x8000, 0x9FFF, NULL, NULL, bus_read_unmapped, bus_write_unmapped);
+	bus_map_vram_bank(gb, 0);
+	// CART RAM, mapped by the mbc
+	bus_map_cart_ram(gb, NULL, NULL);
+	// WRAM, echo ram mirrors 0xC000 - 0xDDFF; 0xD000 - 0xDFFF is banked on cgb
+	bus_map(gb, 0xC000, 0xCFFF, ctx->wram, ctx->wram, bus_read_unmapped, bus_write_unmapped);
+	bus_map(gb, 0xE000, 0xEFFF, ctx->wram, ctx->wram, bus_read_unmapped, bus_write_unmapped);
+	bus_map(gb, 0xD000, 0xDFFF, NULL, NULL, bus_read_unmapped, bus_write_unmapped);
+	bus_map(gb, 0xF000, 0xFDFF, NULL, NULL, bus_read_unmapped, bus_write_unmapped);
+	bus_map_wram_bank(gb, 1);
+	bus_map(gb, 0xFE00, 0xFEFF, NULL, NULL, bus_read_oam, bus_write_oam);
+	bus_map(gb, 0xFF00, 0xFFFF, NULL, NULL, bus_read_io, bus_write_io);
+	// registers not claimed by a subsystem behave as plain memory
+	for (u16 addr = 0xFF00; addr < 0xFF80; addr++)
+		bus_register_io(gb, addr, NULL, NULL);
+	if (ctx->cgb) {
+		bus_register_io(gb, ADDR_VBK, bus_read_vbk, bus_write_vbk);
+		bus_register_io(gb, ADDR_SVBK, bus_read_svbk, bus_write_svbk);
+	}
+
+	ctx->mem[ADDR_JOYPAD] = 0xCF;
+	ctx->mem[ADDR_IF] = 0x01;
+	// ctx->mem[ADDR_NR10] = 0x80;
+	// ctx->mem[ADDR_NR11] = 0xBF;
+	// ctx->mem[ADDR_NR12] = 0xF3;
+	// ctx->mem[ADDR_NR14] = 0xBF;
+	// ctx->mem[ADDR_NR21] = 0x3F;
+	// ctx->mem[ADDR_NR22] = 0x00;
+	// ctx->mem[ADDR_NR24] = 0xBF;
+	// ctx->mem[ADDR_NR30] = 0x7F;
+	// ctx->mem[ADDR_NR31] = 0xFF;
+	// ctx->mem[ADDR_NR32] = 0x9F;
+	// ctx->mem[ADDR_NR33] = 0xBF;
+	// ctx->mem[ADDR_NR41] = 0xFF;
+	// ctx->mem[ADDR_NR42] = 0x00;
+	// ctx->mem[ADDR_NR43] = 0x00;
+	// ctx->mem[ADDR_NR50] = 0x77;
+	// ctx->mem[ADDR_NR51] = 0xF3;
+	// ctx->mem[ADDR_NR52] = 0xF1;
+	ctx->mem[ADDR_LCDC] = 0x91;
+	ctx->mem[ADDR_SCY] = 0x00;
+	ctx->mem[ADDR_SCX] = 0x00;
+	ctx->mem[ADDR_LY] = 0x00;
+	ctx->mem[ADDR_LYC] = 0x00;
+	ctx->mem[ADDR_BGP] = 0xFC;
+	ctx->mem[ADDR_OBP0] = 0xFF;
+	ctx->mem[ADDR_OBP1] = 0xFF;
+	ctx->mem[ADDR_WY] = 0x00;
+	ctx->mem[ADDR_WX] = 0x00;
+	// ctx->mem[ADDR_HDMA5] = 0xFF;
+	// ctx->mem[ADDR_SVBK] = 0x01;
+}
+
+void bus_shutdown(gbc_machine *gb) {
+	bus_ctx *ctx = &gb->bus;
+	free(ctx->mem);
+	free(ctx->vram);
+	free(ctx->wram);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+u32 bus_rom_bank(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	return ctx->rom_bank[addr >= ROM_BANK_SIZE];
+}
+
+u8 bus_read(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	const u8 *page = ctx->read_map[BUS_PAGE(addr)];
+	if (page)
+		return page[addr & 0xFF];
+	if (ctx->traps[BUS_PAGE(addr)])
+		return bus_read_trapped(gb, addr);
+	return ctx->read_handlers[BUS_PAGE(addr)](gb, addr);
+}
+
+u8 bus_fetch(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	const u8 *page = ctx->read_map[BUS_PAGE(addr)];
+	if (page)
+		return page[addr & 0xFF];
+
+	u8 traps = ctx->traps[BUS_PAGE(addr)];
+	if (!traps)
+		return ctx->read_handlers[BUS_PAGE(addr)](gb, addr);
+	if (traps & BUS_TRAP_PROFILE)
+		profile_access(gb, PROFILE_FETCH, addr);
+	if (traps & BUS_TRAP_DMA)
+		return 0xFF;
+	u8 val = bus_read_backing(gb, addr);
+	if (traps & BUS_TRAP_WATCH_EXEC)
+		watch_check(gb, WATCH_EXEC, addr, val);
+	return val;
+}
+
+u16 bus_read16(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	// both bytes on the same plain page (stack, rom operands), one lookup
+	const u8 *page = ctx->read_map[BUS_PAGE(addr)];
+	if (page && (addr & 0xFF) != 0xFF)
+		return page[addr & 0xFF] | (page[(addr & 0xFF) + 1] << 8);
+	return bus_read(gb, addr) | (bus_read(gb, addr+1) << 8);
+}
+
+void bus_write(gbc_machine *gb, u16 addr, u8 val) {
+	bus_ctx *ctx = &gb->bus;
+	u8 *page = ctx->write_map[BUS_PAGE(addr)];
+	if (page)
+		page[addr & 0xFF] = val;
+	else if (ctx->traps[BUS_PAGE(addr)])
+		bus_write_trapped(gb, addr, val);
+	else
+		ctx->write_handlers[BUS_PAGE(addr)](gb, addr, val);
+}
+
+void bus_write16(gbc_machine *gb, u16 addr, u16 val) {
+	bus_ctx *ctx = &gb->bus;
+	u8 *page = ctx->write_map[BUS_PAGE(addr)];
+	if (page && (addr & 0xFF) != 0xFF) {
+		page[addr & 0xFF] = val & 0xFF;
+		page[(addr & 0xFF) + 1] = val >> 8;
+		return;
 	}
-	ctx.ram = calloc(1, (ram_bank_count ? (RAM_BANK_SIZE * ram_bank_count) : RAM_BANK_SIZE));
-
-	ctx.rom_bank = 0;
-	ctx.ram_bank = 0;
-	ctx.vram_bank = 0;
-
-	ctx.mem[ADDR_JOYPAD] = 0xCF;
-	ctx.mem[ADDR_SC] = 0x7E;
-	ctx.mem[ADDR_IF] = 0x01;
-	// ctx.mem[ADDR_NR10] = 0x80;
-	// ctx.mem[ADDR_NR11] = 0xBF;
-	// ctx.mem[ADDR_NR12] = 0xF3;
-	// ctx.mem[ADDR_NR14] = 0xBF;
-	// ctx.mem[ADDR_NR21] = 0x3F;
-	// ctx.mem[ADDR_NR22] = 0x00;
-	// ctx.mem[ADDR_NR24] = 0xBF;
-	// ctx.mem[ADDR_NR30] = 0x7F;
-	// ctx.mem[ADDR_NR31] = 0xFF;
-	// ctx.mem[ADDR_NR32] = 0x9F;
-	// ctx.mem[ADDR_NR33] = 0xBF;
-	// ctx.mem[ADDR_NR41] = 0xFF;
-	// ctx.mem[ADDR_NR42] = 0x00;
-	// ctx.mem[ADDR_NR43] = 0x00;
-	// ctx.mem[ADDR_NR50] = 0x77;
-	// ctx.mem[ADDR_NR51] = 0xF3;
-	// ctx.mem[ADDR_NR52] = 0xF1;
-	ctx.mem[ADDR_LCDC] = 0x91;
-	ctx.mem[ADDR_SCY] = 0x00;
-	ctx.mem[ADDR_SCX] = 0x00;
-	ctx.mem[ADDR_LY] = 0x00;
-	ctx.mem[ADDR_LYC] = 0x00;
-	// ctx.mem[ADDR_BGP] = 0xFC;
-	// ctx.mem[ADDR_OBP0] = 0xFF;
-	// ctx.mem[ADDR_OBP1] = 0xFF;
-	// ctx.mem[ADDR_WY] = 0x00;
-	// ctx.mem[ADDR_WX] = 0x00;
-	// ctx.mem[ADDR_HDMA5] = 0xFF;
-	// ctx.mem[ADDR_SVBK] = 0x01;
-}
-
-u8 bus_read(u16 addr) {
-	if (addr < 0x8000) {
-		// 0x0000 - 0x7FFF
-		// ROM SWITCHABLE BANK 0x4000
-		return ctx.rom[addr];
+	bus_write(gb, addr, val & 0xFF);
+	bus_write(gb, addr+1, (val >> 8) & 0xFF);
+}
+
+// the if-chain address decode the page tables replaced, over the same
+// backing memory and handlers, as a baseline for bus_benchmark
+static u8 bus_bench_chain_read(gbc_machine *gb, u16 addr) {
+	bus_ctx *ctx = &gb->bus;
+	if (addr < 0x4000) {
+		return ctx->rom[ctx->rom_bank[0] * ROM_BANK_SIZE + addr];
+	} else if (addr < 0x8000) {
+		return ctx->rom[ctx->rom_bank[1] * ROM_BANK_SIZE + addr - 0x4000];
 	} else if (addr < 0xA000) {
-		// 0x8000 - 0x9FFF
-		// LCD RAM
-		// bankable?
-		//return ctx.mem[ctx.vram_bank * VRAM_BANK_SIZE + addr];
-		return ctx.mem[addr];
+		return ctx->vram[ctx->vram_bank * VRAM_BANK_SIZE + addr - 0x8000];
 	} else if (addr < 0xC000) {
-		// 0xA000 - 0xBFFF
-		// CART RAM
-		// if (!ctx.ram_enabled)
-		// 	return 0xFF;
-		return ctx.mem[addr];
+		return mbc_ram_read(gb, addr);
+	} else if (addr < 0xD000) {
+		return ctx->wram[addr - 0xC000];
 	} else if (addr < 0xE000) {
-		// 0xC000 - 0xDFFF
-		// bankable ram
-		return ctx.mem[addr];
+		return ctx->wram[ctx->wram_bank * WRAM_BANK_SIZE + addr - 0xD000];
 	} else if (addr < 0xFE00) {
-		// 0xE000 - 0xFDFF
-		// check echo ram access
-		return ctx.mem[addr-0x2000];
-	} else if (addr < 0xFE9F) {
-		// 0xFE00 - 0xFE9F
-		// when OAM blocked return 0xFF;
-		// if (ctx.dma_transfer)
-			// return 0xFF;
-		return ctx.mem[addr];
-	} else if (addr < 0xFEFF) {
-		// 0xFEA0 - 0xFE9F
-		// RESERVED / UNUSABLE
-		return 0x0;
-	} else if (addr < 0xFF80) {
-		switch (addr) {
-			case ADDR_DIV:
-				return timer_read(ADDR_DIV);
-			case ADDR_TIMA:
-				return timer_read(ADDR_TIMA);
-			case ADDR_TMA:
-				return timer_read(ADDR_TMA);
-			case ADDR_TAC:
-				return timer_read(ADDR_TAC);
-			case ADDR_IF:
-				return ctx.mem[addr];
-			break;
-			case ADDR_LCDC:
-				return ctx.mem[addr];
-			break;
-			case ADDR_STAT:
-				return ctx.mem[addr];
-			break;
-			case ADDR_LY:
-				return 0x90;
-			break;
-			default:
-				return ctx.mem[addr];
-		}
-	} else if (addr < 0xFFFF) {
-		// high ram
-		return ctx.mem[addr];
-	} else if (addr == 0xFFFF) {
-		return ctx.mem[addr]; // ie
-	} else {
-		printf("ERR: bus_read not supported at address: %02X\n", addr);
+		return bus_bench_chain_read(gb, addr - 0x2000);
+	} else if (addr < 0xFF00) {
+		return bus_read_oam(gb, addr);
 	}
+	return bus_read_io(gb, addr);
+}
 
-	return 0x0;
+static double bus_bench_seconds(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
 }
 
-u16 bus_read16(u16 addr) {
-	return bus_read(addr) | (bus_read(addr+1) << 8);
-}
-
-void bus_write(u16 addr, u8 val) {
-	if (addr <= 0x1FFF) {
-		// ROM SPACE
-		// mbc1 logic
-		// ctx.ram_enabled = (val == 0xA);
-	} else if (0x2000 <= addr && addr < 0x8000) {
-		// TODO: ROM / RAM switch
-	} else if (0x8000 <= addr && addr < 0xA000) {
-		//ctx.vram[(ctx.vram_bank + VRAM_BANK_SIZE) + (addr - 0x8000)] = val;
-		ctx.mem[addr] = val;
-	} else if (0xA000 <= addr && addr < 0xC000) {
-		// cart ram (save progress)
-		// TODO banking
-		//ctx.ram[(ctx.ram_bank * RAM_BANK_SIZE) + (addr - 0xA000)] = val;
-		ctx.mem[addr] = val;
-	} else if (0xC000 <= addr && addr < 0xE000) {
-		// bankable ram
-		// if (ctx.ram_enabled)
-		ctx.mem[addr] = val;
-	} else if (addr >= 0xFE00 && addr < 0xFE9F) {
-		// OAM
-		ctx.mem[addr] = val;
-	} else if (addr >= 0xFEA0 && addr < 0xFEFF) {
-		// NOT USABLE
-	} else if (addr >= 0xFF00 && addr < 0xFF80) {
-		switch (addr) {
-			case ADDR_JOYPAD:
-				// TODO
-				ctx.mem[ADDR_JOYPAD] = val;
-			break;
-			case ADDR_DIV:
-				timer_write(ADDR_DIV, val);
-			break;
-			case ADDR_TIMA:
-				timer_write(ADDR_TIMA, val);
-			break;
-			case ADDR_TMA:
-				timer_write(ADDR_TMA, val);
-			break;
-			case ADDR_TAC:
-				timer_write(ADDR_TAC, val);
-			break;
-			case ADDR_IF:
-				ctx.mem[addr] = 0xE0 | val;
-			break;
-			case ADDR_LCDC:
-				ctx.mem[addr] = val;
-			break;
-			case ADDR_STAT:
-				ctx.mem[addr] = val & 0xFC;
-			break;
-			case ADDR_LY:
-				ctx.mem[addr] = val;
-			break;
-			case ADDR_DMA_TRANSFER:
-				ctx.dma_transfer = true;
-				ppu_dma_start(val);
-			break;
-			default:
-				ctx.mem[addr] = val;
-			break;
+void bus_benchmark(gbc_machine *gb) {
+	enum { ADDRS = 4096, ITERATIONS = 2000 };
+	static const u16 io[] = { ADDR_DIV, ADDR_TIMA, ADDR_IF, ADDR_LCDC, ADDR_STAT, ADDR_SCY, ADDR_LY, ADDR_BGP };
+	static u16 addrs[ADDRS];
+	u32 seed = 1;
+	u32 sum = 0;
+
+	// 60% rom, 20% wram, 10% hram, 10% io registers
+	for (u32 i = 0; i < ADDRS; i++) {
+		seed = seed * 1103515245 + 12345;
+		u32 kind = (seed >> 16) % 10, offset = seed >> 8;
+		if (kind < 6)
+			addrs[i] = offset & 0x7FFF;
+		else if (kind < 8)
+			addrs[i] = 0xC000 + (offset & 0x1FFF);
+		else if (kind < 9)
+			addrs[i] = 0xFF80 + (offset % 0x7F);
+		else
+			addrs[i] = io[offset % (sizeof(io) / sizeof(io[0]))];
+	}
+
+	double start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++)
+			sum += bus_bench_chain_read(gb, addrs[i]);
+	}
+	double chain_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
+
+	start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++)
+			sum += bus_read(gb, addrs[i]);
+	}
+	double table_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
+
+	// 16 bit accesses as the cpu does them: push/pop pairs on a wram stack
+	// and rom operand reads, as one access and as two byte accesses
+	start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++) {
+			u16 sp = 0xD000 - 2 * (i & 0x3F);
+			bus_write(gb, sp, i & 0xFF);
+			bus_write(gb, sp + 1, i >> 8);
+			sum += bus_read(gb, sp) | (bus_read(gb, sp + 1) << 8);
 		}
-	} else if (addr >= 0xFF80 && addr < 0xFFFF) {
-		ctx.mem[addr] = val;
-	} else if (addr == 0xFFFF) {
-		ctx.mem[addr] = val;
-	} else {
-		//printf("ERR: bus_write not supported at address: %02X\n", addr);
-		ctx.mem[addr] = val;
 	}
-}
+	double stack_bytes_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
+
+	start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++) {
+			u16 sp = 0xD000 - 2 * (i & 0x3F);
+			bus_write16(gb, sp, i);
+			sum += bus_read16(gb, sp);
+		}
+	}
+	double stack_words_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
+
+	start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++) {
+			u16 addr = addrs[i] & 0x7FFF;
+			sum += bus_read(gb, addr) | (bus_read(gb, addr + 1) << 8);
+		}
+	}
+	double rom_bytes_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
+
+	start = bus_bench_seconds();
+	for (u32 it = 0; it < ITERATIONS; it++) {
+		for (u32 i = 0; i < ADDRS; i++)
+			sum += bus_read16(gb, addrs[i] & 0x7FFF);
+	}
+	double rom_words_ns = (bus_bench_seconds() - start) * 1e9 / ((double)ITERATIONS * ADDRS);
 
-void bus_write16(u16 addr, u16 val) {
-	bus_write(addr, val & 0xFF);
-	bus_write(addr+1, (val >> 8) & 0xFF);
+	printf("%-24s %10s\n", "access", "ns");
+	printf("%-24s %10.2f\n", "read, address chain", chain_ns);
+	printf("%-24s %10.2f\n", "read, page table", table_ns);
+	printf("%-24s %10.2f\n", "push/pop, two bytes", stack_bytes_ns);
+	printf("%-24s %10.2f\n", "push/pop, 16 bit", stack_words_ns);
+	printf("%-24s %10.2f\n", "rom read16, two bytes", rom_bytes_ns);
+	printf("%-24s %10.2f\n", "rom read16, 16 bit", rom_words_ns);
+	// keeps the reads from being optimized out
+	printf("checksum %08X\n", sum);
 }
@@ -1,9 +1,15 @@
 #include "cart.h"
+#include "gbc.h"
 
 #include <stdio.h>
 #include <string.h>
 
-static uint8_t scrolling_logo[] = {
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const uint8_t scrolling_logo[] = {
     0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
     0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
     0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
@@ -12,18 +18,84 @@ static uint8_t scrolling_logo[] = {
     0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E
 };
 
-static cart_context ctx;
+cart_context *get_cart_context(gbc_machine *gb) {
+    return &gb->cart;
+}
 
-cart_context *get_cart_context() {
-    return &ctx;
+u8 cart_read(gbc_machine *gb, u16 addr) {
+    cart_context *ctx = &gb->cart;
+    return addr < ctx->rom_size ? ctx->rom_data[addr] : 0xFF;
 }
 
-u8 cart_read(u16 addr) {
-    return ctx.rom_data[addr];
+#ifndef _WIN32
+// map the rom file read-only, the bus banks point straight into the mapping
+// so instances running the same rom share its physical pages
+static bool cart_map_file(cart_context *ctx, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+        return false;
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        return false;
+
+    ctx->rom_data = data;
+    ctx->rom_size = st.st_size;
+    ctx->mapped = true;
+    return true;
+}
+#endif
+
+// buffered fallback for pipes and other streams that can't be mapped
+static bool cart_read_file(cart_context *ctx, FILE *file) {
+    u8 *data = NULL;
+    size_t size = 0, capacity = 0;
+
+    for (;;) {
+        if (size == capacity) {
+            capacity = capacity ? capacity * 2 : 0x8000;
+            u8 *grown = realloc(data, capacity);
+            if (grown == NULL) {
+                fprintf(stderr, "memory allocation failed!\n");
+                free(data);
+                return false;
+            }
+            data = grown;
+        }
+
+        size_t n = fread(data + size, 1, capacity - size, file);
+        size += n;
+        if (n == 0)
+            break;
+    }
+
+    if (ferror(file)) {
+        free(data);
+        return false;
+    }
+
+    // the bus maps whole 256-byte pages, keep the tail page readable
+    size_t padded = (size + 0xFF) & ~(size_t)0xFF;
+    if (padded > capacity) {
+        u8 *grown = realloc(data, padded);
+        if (grown == NULL) {
+            fprintf(stderr, "memory allocation failed!\n");
+            free(data);
+            return false;
+        }
+        data = grown;
+    }
+    memset(data + size, 0xFF, padded - size);
+
+    ctx->rom_data = data;
+    ctx->rom_size = size;
+    ctx->mapped = false;
+    return true;
 }
 
-bool cart_init(const char *cart_filepath) {
-	ctx.filepath = cart_filepath;
+bool cart_init(gbc_machine *gb, const char *cart_filepath) {
+    cart_context *ctx = &gb->cart;
+    ctx->filepath = cart_filepath;
 
     FILE *file = fopen(cart_filepath, "rb");
     if (!file) {
@@ -31,60 +103,77 @@ bool cart_init(const char *cart_filepath) {
         return false;
     }
 
-    fseek(file, 0, SEEK_END);
-    ctx.rom_size = ftell(file);
-
     // TODO: enforce max rom size
-    ctx.rom_data = malloc(ctx.rom_size);
-	if (ctx.rom_data == NULL) {
-		fprintf(stderr, "memory allocation failed!\n");
-        fclose(file);
-		return false;
-	}
-
-    rewind(file);
-    fread(ctx.rom_data, ctx.rom_size, 1, file);
-    const u32 last_read = ftell(file);
+    bool loaded = false;
+#ifndef _WIN32
+    loaded = cart_map_file(ctx, fileno(file));
+#endif
+    if (!loaded)
+        loaded = cart_read_file(ctx, file);
     fclose(file);
 
-    if (ctx.rom_size != last_read) {
-    	fprintf(stderr, "ERROR: failed to read cartridge data from %s\n", cart_filepath);
-        free(ctx.rom_data);
+    if (!loaded) {
+        fprintf(stderr, "ERROR: failed to read cartridge data from %s\n", cart_filepath);
         return false;
     }
 
-    // rom actually starts at 0x100
-    ctx.header = (rom_header *)(ctx.rom_data + 0x100);
-    ctx.header->game_title[15] = 0; // ensure str termination
+    if (ctx->rom_size < 0x150) {
+        fprintf(stderr, "ERROR: cartridge too small for a header\n");
+        cart_shutdown(gb);
+        return false;
+    }
 
-    if (memcmp(&ctx.rom_data[0x104], scrolling_logo, sizeof(scrolling_logo)) != 0) {
+    // rom actually starts at 0x100, parsed in place
+    ctx->header = (const rom_header *)(ctx->rom_data + 0x100);
+
+    if (memcmp(&ctx->rom_data[0x104], scrolling_logo, sizeof(scrolling_logo)) != 0) {
         fprintf(stderr, "ERROR: cartridge missing logo header\n");
-        free(ctx.rom_data);
+        cart_shutdown(gb);
         return false;
     }
 
     // run checksum
     u16 checksum  = 0;
     for (int i = 0x0134; i <= 0x014C; i++)
-    	checksum = checksum - (ctx.rom_data[i] - 1);
+    	checksum = checksum - (ctx->rom_data[i] - 1);
     bool r_checksum = (checksum & 0xFF);
-    // printf("DEBUG: CHECKSUM: %2.2X (%s)\n", ctx.header->checksum, r_checksum ? "PASSED" : "FAILED");
-    return r_checksum;
+    // printf("DEBUG: CHECKSUM: %2.2X (%s)\n", ctx->header->checksum, r_checksum ? "PASSED" : "FAILED");
+    if (!r_checksum) {
+        cart_shutdown(gb);
+        return false;
+    }
+    return true;
 }
 
-void cart_debug() {
+void cart_debug(gbc_machine *gb) {
+    cart_context *ctx = &gb->cart;
     printf("CARTRIDGE LOADED:\n");
-    printf("\tPATH     : %s\n",    ctx.filepath);
-    printf("\tTITLE    : %s\n",    ctx.header->game_title);
-    printf("\tTYPE     : %2.2X\n", ctx.header->type);
-    printf("\tROM SIZE : %d KB\n", 32 << ctx.header->rom_size);
-    printf("\tRAM SIZE : %2.2X\n", ctx.header->ram_size);
-    printf("\tLIC CODE : %2.2X\n", ctx.header->license_code);
-    printf("\tROM VERS : %2.2X\n", ctx.header->version);
+    printf("\tPATH     : %s\n",    ctx->filepath);
+    printf("\tTITLE    : %.16s\n", ctx->header->game_title);
+    printf("\tTYPE     : %2.2X\n", ctx->header->type);
+    printf("\tROM SIZE : %d KB\n", 32 << ctx->header->rom_size);
+    printf("\tRAM SIZE : %2.2X\n", ctx->header->ram_size);
+    printf("\tLIC CODE : %2.2X\n", ctx->header->license_code);
+    printf("\tROM VERS : %2.2X\n", ctx->header->version);
     printf("\tPC       : 0x%02X%02X%02X%02X\n",
-        ctx.header->entry_point[0],
-        ctx.header->entry_point[1],
-        ctx.header->entry_point[2],
-        ctx.header->entry_point[3]
+        ctx->header->entry_point[0],
+        ctx->header->entry_point[1],
+        ctx->header->entry_point[2],
+        ctx->header->entry_point[3]
     );
 }
+
+void cart_shutdown(gbc_machine *gb) {
+    cart_context *ctx = &gb->cart;
+    if (ctx->mapped) {
+#ifndef _WIN32
+        munmap((void *)ctx->rom_data, ctx->rom_size);
+#endif
+    } else {
+        free((void *)ctx->rom_data);
+    }
+    ctx->rom_data = NULL;
+    ctx->rom_size = 0;
+    ctx->mapped = false;
+    ctx->header = NULL;
+}
@@ -3,53 +3,141 @@
 #include <stdio.h>
 
 #include "common.h"
+#include "gbc.h"
 #include "bus.h"
 #include "cart.h"
 #include "timer.h"
 #include "interrupt.h"
 
 
-#define CPU_REG_A ctx.registers.AF.bytes.h
-#define CPU_REG_F ctx.registers.AF.bytes.l
-#define CPU_REG_B ctx.registers.BC.bytes.h
-#define CPU_REG_C ctx.registers.BC.bytes.l
-#define CPU_REG_D ctx.registers.DE.bytes.h
-#define CPU_REG_E ctx.registers.DE.bytes.l
-#define CPU_REG_H ctx.registers.HL.bytes.h
-#define CPU_REG_L ctx.registers.HL.bytes.l
+#define CPU_REG_A ctx->registers.AF.bytes.h
+#define CPU_REG_F ctx->registers.AF.bytes.l
+#define CPU_REG_B ctx->registers.BC.bytes.h
+#define CPU_REG_C ctx->registers.BC.bytes.l
+#define CPU_REG_D ctx->registers.DE.bytes.h
+#define CPU_REG_E ctx->registers.DE.bytes.l
+#define CPU_REG_H ctx->registers.HL.bytes.h
+#define CPU_REG_L ctx->registers.HL.bytes.l
+
+#define CPU_REG_AF ctx->registers.AF.val
+#define CPU_REG_BC ctx->registers.BC.val
+#define CPU_REG_DE ctx->registers.DE.val
+#define CPU_REG_HL ctx->registers.HL.val
+
+// flag reads go through cpu_flags(gb) so a pending lazy ALU result is
+// materialized into F first
+#define CPU_FLAG_Z BIT(cpu_flags(gb), 7)
+#define CPU_FLAG_N BIT(cpu_flags(gb), 6)
+#define CPU_FLAG_H BIT(cpu_flags(gb), 5)
+#define CPU_FLAG_C cpu_flags_carry(gb)
+
+#define CPU_SET_FLAG_Z(x) CPU_REG_F = ((cpu_flags(gb) & 0x7f) | (x ? 0x80 : 0))
+#define CPU_SET_FLAG_N(x) CPU_REG_F = ((cpu_flags(gb) & 0xbf) | (x ? 0x40 : 0))
+#define CPU_SET_FLAG_H(x) CPU_REG_F = ((cpu_flags(gb) & 0xdf) | (x ? 0x20 : 0))
+#define CPU_SET_FLAG_C(x) CPU_REG_F = ((cpu_flags(gb) & 0xef) | (x ? 0x10 : 0))
+
+static void cpu_flags_materialize(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	const cpu_lazy_flags *l = &ctx->lazy_flags;
+	bool z = false, n = false, h = false, c = false;
+
+	switch (l->op) {
+		case CPU_LAZY_ADD: {
+			u32 r = l->a + l->b;
+			z = (r & 0xFF) == 0;
+			h = ((l->a & 0xF) + (l->b & 0xF)) > 0xF;
+			c = r > 0xFF;
+		}
+		break;
+		case CPU_LAZY_ADC: {
+			u16 r = l->a + l->b + l->c;
+			z = (r & 0xFF) == 0;
+			h = ((l->a & 0xF) + (l->b & 0xF) + l->c) > 0xF;
+			c = r > 0xFF;
+		}
+		break;
+		case CPU_LAZY_SUB: {
+			u16 r = l->a - l->b;
+			z = r == 0;
+			n = true;
+			h = (l->a & 0xF) < (l->b & 0xF);
+			c = l->a < l->b;
+		}
+		break;
+		case CPU_LAZY_SBC: {
+			u8 r = l->a - l->b - l->c;
+			z = r == 0;
+			n = true;
+			h = ((l->a & 0xF) - (l->b & 0xF) - l->c) < 0;
+			c = (l->a - l->b - l->c) < 0;
+		}
+		break;
+		case CPU_LAZY_INC:
+			z = (l->a & 0xFF) == 0;
+			h = (l->a & 0xF) == 0;
+			c = l->c;
+		break;
+		case CPU_LAZY_DEC:
+			z = (l->a & 0xFF) == 0;
+			n = true;
+			h = (l->a & 0xF) == 0xF;
+			c = l->c;
+		break;
+		default:
+			return;
+	}
+
+	CPU_REG_F = (z << 7) | (n << 6) | (h << 5) | (c << 4);
+	ctx->lazy_flags.op = CPU_LAZY_NONE;
+}
 
-#define CPU_REG_AF ctx.registers.AF.val
-#define CPU_REG_BC ctx.registers.BC.val
-#define CPU_REG_DE ctx.registers.DE.val
-#define CPU_REG_HL ctx.registers.HL.val
+static ALWAYS_INLINE u8 cpu_flags(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	if (ctx->lazy_flags.op != CPU_LAZY_NONE)
+		cpu_flags_materialize(gb);
+	return CPU_REG_F;
+}
 
-#define CPU_FLAG_Z BIT(CPU_REG_F, 7)
-#define CPU_FLAG_N BIT(CPU_REG_F, 6)
-#define CPU_FLAG_H BIT(CPU_REG_F, 5)
-#define CPU_FLAG_C BIT(CPU_REG_F, 4)
+static ALWAYS_INLINE bool cpu_flags_carry(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	// inc/dec only carry the previous C along, no need to materialize
+	if (ctx->lazy_flags.op == CPU_LAZY_INC || ctx->lazy_flags.op == CPU_LAZY_DEC)
+		return ctx->lazy_flags.c;
+	return BIT(cpu_flags(gb), 4);
+}
 
-#define CPU_SET_FLAG_Z(x) CPU_REG_F = ((CPU_REG_F & 0x7f) | (x ? 0x80 : 0))
-#define CPU_SET_FLAG_N(x) CPU_REG_F = ((CPU_REG_F & 0xbf) | (x ? 0x40 : 0))
-#define CPU_SET_FLAG_H(x) CPU_REG_F = ((CPU_REG_F & 0xdf) | (x ? 0x20 : 0))
-#define CPU_SET_FLAG_C(x) CPU_REG_F = ((CPU_REG_F & 0xef) | (x ? 0x10 : 0))
+// overwrite all flags, dropping any pending lazy result
+static ALWAYS_INLINE void cpu_set_flags(gbc_machine *gb, u8 f) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->lazy_flags.op = CPU_LAZY_NONE;
+	CPU_REG_F = f;
+}
 
-static cpu_context ctx;
+static ALWAYS_INLINE void cpu_set_flags_lazy(gbc_machine *gb, cpu_lazy_op op, u16 a, u16 b, bool c) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->lazy_flags.op = op;
+	ctx->lazy_flags.a = a;
+	ctx->lazy_flags.b = b;
+	ctx->lazy_flags.c = c;
+}
 
-u16* cpu_reg16_ptr(cpu_register r) {
+static ALWAYS_INLINE u16* cpu_reg16_ptr(gbc_machine *gb, cpu_register r) {
+    cpu_context *ctx = &gb->cpu;
     switch (r) {
-        case REG_AF: return &(CPU_REG_AF);
+        case REG_AF: cpu_flags(gb); return &(CPU_REG_AF);
         case REG_BC: return &(CPU_REG_BC);
         case REG_DE: return &(CPU_REG_DE);
         case REG_HL: return &(CPU_REG_HL);
-        case REG_SP: return &ctx.registers.SP;
+        case REG_SP: return &ctx->registers.SP;
         default: return NULL;
     }
 }
 
-u8* cpu_reg8_ptr(cpu_register r) {
+static ALWAYS_INLINE u8* cpu_reg8_ptr(gbc_machine *gb, cpu_register r) {
+    cpu_context *ctx = &gb->cpu;
     switch (r) {
         case REG_A: return &(CPU_REG_A);
-        case REG_F: return &(CPU_REG_F);
+        case REG_F: cpu_flags(gb); return &(CPU_REG_F);
         case REG_B: return &(CPU_REG_B);
         case REG_C: return &(CPU_REG_C);
         case REG_D: return &(CPU_REG_D);
@@ -60,8 +148,8 @@ u8* cpu_reg8_ptr(cpu_register r) {
     }
 }
 
-u8 cpu_read_reg(cpu_register r) {
-	u8* reg8ptr = cpu_reg8_ptr(r);
+static ALWAYS_INLINE u8 cpu_read_reg(gbc_machine *gb, cpu_register r) {
+	u8* reg8ptr = cpu_reg8_ptr(gb, r);
 	if (reg8ptr != NULL) {
 		return *reg8ptr;
 	} else {
@@ -70,17 +158,17 @@ u8 cpu_read_reg(cpu_register r) {
 	return 0;
 }
 
-u16 cpu_read_reg16(cpu_register r) {
-	u16* reg16ptr = cpu_reg16_ptr(r);
+static ALWAYS_INLINE u16 cpu_read_reg16(gbc_machine *gb, cpu_register r) {
+	u16* reg16ptr = cpu_reg16_ptr(gb, r);
 	if (reg16ptr != NULL) {
 		return *reg16ptr;
 	} else {
-		return cpu_read_reg(r);
+		return cpu_read_reg(gb, r);
 	}
 }
 
-void cpu_write_reg16(cpu_register r, u16 v) {
-	u16* reg16ptr = cpu_reg16_ptr(r);
+static ALWAYS_INLINE void cpu_write_reg16(gbc_machine *gb, cpu_register r, u16 v) {
+	u16* reg16ptr = cpu_reg16_ptr(gb, r);
 	if (reg16ptr != NULL) {
 		*reg16ptr = v;
 	} else {
@@ -88,40 +176,40 @@ void cpu_write_reg16(cpu_register r, u16 v) {
 	}
 }
 
-void cpu_write_reg(cpu_register r, u8 v) {
-	u8* reg8ptr = cpu_reg8_ptr(r);
+static ALWAYS_INLINE void cpu_write_reg(gbc_machine *gb, cpu_register r, u8 v) {
+	u8* reg8ptr = cpu_reg8_ptr(gb, r);
 	if (reg8ptr != NULL) {
 		*reg8ptr = v;
 	} else {
-		cpu_write_reg16(r, v);
+		cpu_write_reg16(gb, r, v);
 	}
 }
 
-void cpu_inc_reg(cpu_register r) {
-	u16* reg16ptr = cpu_reg16_ptr(r);
+static ALWAYS_INLINE void cpu_inc_reg(gbc_machine *gb, cpu_register r) {
+	u16* reg16ptr = cpu_reg16_ptr(gb, r);
 	if (reg16ptr != NULL) {
 		(*reg16ptr)++;
 	} else {
-		u8* reg8ptr = cpu_reg8_ptr(r);
+		u8* reg8ptr = cpu_reg8_ptr(gb, r);
 		if (reg8ptr != NULL) {
 			(*reg8ptr)++;
 		}
 	}
 }
 
-void cpu_dec_reg(cpu_register r) {
-	u16* reg16ptr = cpu_reg16_ptr(r);
+static ALWAYS_INLINE void cpu_dec_reg(gbc_machine *gb, cpu_register r) {
+	u16* reg16ptr = cpu_reg16_ptr(gb, r);
 	if (reg16ptr != NULL) {
 		(*reg16ptr)--;
 	} else {
-		u8* reg8ptr = cpu_reg8_ptr(r);
+		u8* reg8ptr = cpu_reg8_ptr(gb, r);
 		if (reg8ptr != NULL) {
 			(*reg8ptr)--;
 		}
 	}
 }
 
-bool cpu_check_cond(cpu_condition_flag flag) {
+static ALWAYS_INLINE bool cpu_check_cond(gbc_machine *gb, cpu_condition_flag flag) {
 	bool z = CPU_FLAG_Z;
 	bool c = CPU_FLAG_C;
 
@@ -135,466 +223,451 @@ bool cpu_check_cond(cpu_condition_flag flag) {
 	}
 }
 
-void cpu_execute_ld() {
-	if (ctx.write_dst) {
-		if (ctx.fetched_data > 0xFF) {
-			bus_write16(ctx.write_dst, ctx.fetched_data);
+static ALWAYS_INLINE void cpu_execute_ld(gbc_machine *gb, const cpu_instruction *in) {
+	cpu_context *ctx = &gb->cpu;
+	if (ctx->write_bus) {
+		if (ctx->fetched_data > 0xFF) {
+			bus_write16(gb, ctx->write_dst, ctx->fetched_data);
 		} else {
-			bus_write(ctx.write_dst, ctx.fetched_data & 0xFF);
+			bus_write(gb, ctx->write_dst, ctx->fetched_data & 0xFF);
 		}
 	} else {
-		if (ctx.current_instruction.r_target >= REG_AF) {
-			cpu_write_reg16(ctx.current_instruction.r_target, ctx.fetched_data);
+		if (in->r_target >= REG_AF) {
+			cpu_write_reg16(gb, in->r_target, ctx->fetched_data);
 		} else {
-			cpu_write_reg(ctx.current_instruction.r_target, (ctx.fetched_data & 0xFF));
+			cpu_write_reg(gb, in->r_target, (ctx->fetched_data & 0xFF));
 		}
 	}
 }
 
-u8 cpu_read_n() {
-	ctx.cycles += 1;
-	return bus_read(ctx.registers.PC++);
+// immediate operands are read at decode time, only the cycles are charged here
+static ALWAYS_INLINE u8 cpu_read_n(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->cycles += 1;
+	return ctx->decoded->imm & 0xFF;
 }
 
-i8 cpu_read_signed_n() {
-	ctx.cycles += 1;
-	return bus_read(ctx.registers.PC++);
+static ALWAYS_INLINE i8 cpu_read_signed_n(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->cycles += 1;
+	return ctx->decoded->imm & 0xFF;
 }
 
-u16 cpu_read_nn() {
-	u16 lo = cpu_read_n();
-	u16 hi = cpu_read_n() << 8;
-	return lo | hi;
-}
-
-void cpu_fetch_instruction() {
-	ctx.current_opcode = bus_read(ctx.registers.PC);
-	ctx.registers.PC += 1;
-
-	if (ctx.current_opcode == 0xCB)
-		ctx.current_instruction = instructions[0x100 + bus_read(ctx.registers.PC++)];
-	else
-		ctx.current_instruction = instructions[ctx.current_opcode];
-
-	ctx.fetched_data = 0;
-	ctx.write_dst = 0;
+static ALWAYS_INLINE u16 cpu_read_nn(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->cycles += 2;
+	return ctx->decoded->imm;
 }
 
-void cpu_fetch_data() {
-	switch (ctx.current_instruction.mode) {
+static ALWAYS_INLINE void cpu_fetch_data_op(gbc_machine *gb, const cpu_instruction *in) {
+	cpu_context *ctx = &gb->cpu;
+	switch (in->mode) {
 		case MODE_NONE:
 		break;
 		case MODE_U8:
-			ctx.fetched_data =  cpu_read_n();
+			ctx->fetched_data =  cpu_read_n(gb);
 		break;
 		case MODE_U16:
 		case MODE_A16:
-			ctx.fetched_data = cpu_read_nn();
+			ctx->fetched_data = cpu_read_nn(gb);
 		break;
 		case MODE_A16_TO_REG: {
-			u16 addr = cpu_read_nn();
-			ctx.fetched_data = bus_read(addr);
+			u16 addr = cpu_read_nn(gb);
+			ctx->fetched_data = bus_read(gb, addr);
 		}
 		break;
 		case MODE_U8_TO_REG:
-			ctx.fetched_data = cpu_read_n();
-			if (ctx.current_instruction.r_source)
-				ctx.fetched_data += cpu_read_reg16(ctx.current_instruction.r_source);
+			ctx->fetched_data = cpu_read_n(gb);
+			if (in->r_source)
+				ctx->fetched_data += cpu_read_reg16(gb, in->r_source);
 		break;
 		case MODE_D8_TO_ADDR:
-			ctx.fetched_data = cpu_read_n();
-			if (ctx.current_instruction.r_target)
-				ctx.write_dst = cpu_read_reg16(ctx.current_instruction.r_target);
+			ctx->fetched_data = cpu_read_n(gb);
+			if (in->r_target) {
+				ctx->write_dst = cpu_read_reg16(gb, in->r_target);
+				ctx->write_bus = true;
+			}
 		break;
 		case MODE_D8:
-			ctx.fetched_data =  cpu_read_signed_n();
+			ctx->fetched_data =  cpu_read_signed_n(gb);
 		break;
 		case MODE_D8_TO_REG:
-			ctx.fetched_data = cpu_read_signed_n();
-			if (ctx.current_instruction.r_source)
-				ctx.fetched_data += cpu_read_reg16(ctx.current_instruction.r_source);
+			ctx->fetched_data = cpu_read_signed_n(gb);
+			if (in->r_source)
+				ctx->fetched_data += cpu_read_reg16(gb, in->r_source);
 		break;
 		case MODE_REG:
-			ctx.fetched_data = cpu_read_reg16(ctx.current_instruction.r_target);
+			ctx->fetched_data = cpu_read_reg16(gb, in->r_target);
 		break;
 		case MODE_REG_TO_REG:
-			ctx.fetched_data = cpu_read_reg16(ctx.current_instruction.r_source);
+			ctx->fetched_data = cpu_read_reg16(gb, in->r_source);
 		break;
 		case MODE_REG_TO_ADDR:
-			ctx.fetched_data = cpu_read_reg16(ctx.current_instruction.r_source);
-			if (ctx.current_instruction.r_target) {
-				u16 n = cpu_read_reg16(ctx.current_instruction.r_target);
-				ctx.write_dst = n;
+			ctx->fetched_data = cpu_read_reg16(gb, in->r_source);
+			if (in->r_target) {
+				u16 n = cpu_read_reg16(gb, in->r_target);
+				ctx->write_dst = n;
 			} else {
-				ctx.write_dst = ctx.current_instruction.byte_length > 2 ? cpu_read_nn() : cpu_read_n();
+				ctx->write_dst = in->byte_length > 2 ? cpu_read_nn(gb) : cpu_read_n(gb);
 			}
+			ctx->write_bus = true;
 		break;
 		case MODE_REG_TO_IOADDR:
-			ctx.fetched_data = cpu_read_reg16(ctx.current_instruction.r_source);
-			if (ctx.current_instruction.r_target) {
-				ctx.write_dst = 0xFF00 + cpu_read_reg16(ctx.current_instruction.r_target);
+			ctx->fetched_data = cpu_read_reg16(gb, in->r_source);
+			if (in->r_target) {
+				ctx->write_dst = 0xFF00 + cpu_read_reg16(gb, in->r_target);
 			} else {
-				ctx.write_dst = ctx.current_instruction.byte_length > 2 ? cpu_read_nn() : cpu_read_n();
+				ctx->write_dst = in->byte_length > 2 ? cpu_read_nn(gb) : cpu_read_n(gb);
 			}
+			ctx->write_bus = true;
 		break;
 		case MODE_ADDR_TO_REG: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_source);
-			ctx.fetched_data = bus_read16(n);
+			u16 n = cpu_read_reg16(gb, in->r_source);
+			ctx->fetched_data = bus_read16(gb, n);
 		}
 		break;
 		case MODE_IOADDR_TO_REG: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_source);
-			ctx.fetched_data = bus_read(0xFF00+n);
+			u16 n = cpu_read_reg16(gb, in->r_source);
+			ctx->fetched_data = bus_read(gb, 0xFF00+n);
 		}
 		break;
 		case MODE_D16_TO_REG:
-			ctx.fetched_data = cpu_read_nn();
+			ctx->fetched_data = cpu_read_nn(gb);
 		break;
 		case MODE_ADDR: {
-			u16 addr = cpu_read_reg16(ctx.current_instruction.r_source);
-			ctx.fetched_data = bus_read(addr);
-			ctx.write_dst = addr;
+			u16 addr = cpu_read_reg16(gb, in->r_source);
+			ctx->fetched_data = bus_read(gb, addr);
+			ctx->write_dst = addr;
+			ctx->write_bus = true;
 		}
 		break;
 		case MODE_A8_TO_REG:
-			ctx.fetched_data = bus_read(0xFF00 + cpu_read_n());
+			ctx->fetched_data = bus_read(gb, 0xFF00 + cpu_read_n(gb));
 		break;
 		case MODE_REG_TO_A8: {
-			ctx.fetched_data = cpu_read_reg16(ctx.current_instruction.r_source);
-			u8 n = cpu_read_n();
-			ctx.write_dst = 0xFF00 + n;
+			ctx->fetched_data = cpu_read_reg16(gb, in->r_source);
+			u8 n = cpu_read_n(gb);
+			ctx->write_dst = 0xFF00 + n;
+			ctx->write_bus = true;
 		}
 		break;
 		case MODE_PARAM:
-			ctx.fetched_data =  ctx.current_instruction.parameter;
+			ctx->fetched_data =  in->parameter;
 		break;
 		default:
-			printf("ERR: address mode not supported: %02X\n", ctx.current_instruction.mode);
+			printf("ERR: address mode not supported: %02X\n", in->mode);
 		break;
 	}
 }
 
-void cpu_execute_instruction() {
-	switch (ctx.current_instruction.type) {
+static ALWAYS_INLINE void cpu_execute_op(gbc_machine *gb, const cpu_instruction *in) {
+	cpu_context *ctx = &gb->cpu;
+	switch (in->type) {
 		case INSTRUCT_NOP:
-			ctx.cycles += 1;
+			ctx->cycles += 1;
 		break;
 
 		case INSTRUCT_HALT:
-			ctx.cycles += 1;
-			ctx.halted = true;
+			ctx->cycles += 1;
+			ctx->halted = true;
 		break;
 
 		case INSTRUCT_ADD: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_target);
-			u32 r = n + ctx.fetched_data;
-			CPU_SET_FLAG_N(0);
-			if (ctx.current_instruction.r_target < REG_AF) {
-				cpu_write_reg(ctx.current_instruction.r_target, r & 0xFF);
-				CPU_SET_FLAG_Z((r & 0xFF) == 0);
-				CPU_SET_FLAG_C(r > 0xFF);
-				CPU_SET_FLAG_H(((n & 0xF) + (ctx.fetched_data & 0xF)) > 0xF);
-				ctx.cycles += 1;
+			u16 n = cpu_read_reg16(gb, in->r_target);
+			u32 r = n + ctx->fetched_data;
+			if (in->r_target < REG_AF) {
+				cpu_write_reg(gb, in->r_target, r & 0xFF);
+				cpu_set_flags_lazy(gb, CPU_LAZY_ADD, n, ctx->fetched_data, 0);
+				ctx->cycles += 1;
 			} else {
-				cpu_write_reg16(ctx.current_instruction.r_target, r & 0xFFFF);
+				cpu_write_reg16(gb, in->r_target, r & 0xFFFF);
+				CPU_SET_FLAG_N(0);
 				CPU_SET_FLAG_C(r > 0xFFFF);
 				CPU_SET_FLAG_H((r & 0xFFF) < (n & 0xFFF));
-				ctx.cycles += 2;
+				ctx->cycles += 2;
 			}
 		}
 		break;
 
 		case INSTRUCT_ADC: {
-			u16 r = cpu_read_reg16(ctx.current_instruction.r_target);
-			CPU_SET_FLAG_H(((r & 0xF) + (ctx.fetched_data & 0xF) + CPU_FLAG_C) > 0xF);
-
-			r += ctx.fetched_data + CPU_FLAG_C;
-			CPU_SET_FLAG_N(0);
-			CPU_SET_FLAG_C(r > 0xFF);
+			u16 n = cpu_read_reg16(gb, in->r_target);
+			bool c = CPU_FLAG_C;
+			u16 r = n + ctx->fetched_data + c;
 
-			if (ctx.current_instruction.r_target < REG_AF) {
-				CPU_SET_FLAG_Z((r & 0xFF) == 0);
-				cpu_write_reg(ctx.current_instruction.r_target, r & 0xFF);
-				ctx.cycles += 1;
+			if (in->r_target < REG_AF) {
+				cpu_write_reg(gb, in->r_target, r & 0xFF);
+				cpu_set_flags_lazy(gb, CPU_LAZY_ADC, n, ctx->fetched_data, c);
+				ctx->cycles += 1;
 			} else {
+				CPU_SET_FLAG_H(((n & 0xF) + (ctx->fetched_data & 0xF) + c) > 0xF);
+				CPU_SET_FLAG_N(0);
+				CPU_SET_FLAG_C(r > 0xFF);
 				CPU_SET_FLAG_Z(r == 0);
-				cpu_write_reg16(ctx.current_instruction.r_target, r);
-				ctx.cycles += 2;
+				cpu_write_reg16(gb, in->r_target, r);
+				ctx->cycles += 2;
 			}
 		}
 		break;
 
 		case INSTRUCT_SUB: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_target);
-			u16 r = n - ctx.fetched_data;
-			if (ctx.current_instruction.r_target < REG_AF) {
-				cpu_write_reg(ctx.current_instruction.r_target, r & 0xFF);
-				ctx.cycles += 1;
+			u16 n = cpu_read_reg16(gb, in->r_target);
+			u16 r = n - ctx->fetched_data;
+			if (in->r_target < REG_AF) {
+				cpu_write_reg(gb, in->r_target, r & 0xFF);
+				cpu_set_flags_lazy(gb, CPU_LAZY_SUB, n, ctx->fetched_data, 0);
+				ctx->cycles += 1;
 			} else {
-				cpu_write_reg16(ctx.current_instruction.r_target, r);
-				ctx.cycles += 2;
+				cpu_write_reg16(gb, in->r_target, r);
+				CPU_SET_FLAG_Z(r == 0);
+				CPU_SET_FLAG_N(1);
+				CPU_SET_FLAG_H((n & 0xF) < (ctx->fetched_data & 0xF));
+				CPU_SET_FLAG_C(n < ctx->fetched_data);
+				ctx->cycles += 2;
 			}
-
-			CPU_SET_FLAG_Z(r == 0);
-			CPU_SET_FLAG_N(1);
-			CPU_SET_FLAG_H((n & 0xF) < (ctx.fetched_data & 0xF));
-			CPU_SET_FLAG_C(n < ctx.fetched_data);
 		}
 		break;
 
 		case INSTRUCT_SBC: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_target);
+			u16 n = cpu_read_reg16(gb, in->r_target);
 			bool c = CPU_FLAG_C;
 
-			if (ctx.current_instruction.r_target < REG_AF) {
-				u8 r = n - ctx.fetched_data - c;
-				cpu_write_reg(ctx.current_instruction.r_target, r);
-				CPU_SET_FLAG_Z(r == 0);
-				ctx.cycles += 1;
+			if (in->r_target < REG_AF) {
+				u8 r = n - ctx->fetched_data - c;
+				cpu_write_reg(gb, in->r_target, r);
+				cpu_set_flags_lazy(gb, CPU_LAZY_SBC, n, ctx->fetched_data, c);
+				ctx->cycles += 1;
 			} else {
-				u16 r = n - ctx.fetched_data - c;
-				cpu_write_reg16(ctx.current_instruction.r_target, r);
+				u16 r = n - ctx->fetched_data - c;
+				cpu_write_reg16(gb, in->r_target, r);
 				CPU_SET_FLAG_Z(r == 0);
-				ctx.cycles += 2;
+				CPU_SET_FLAG_H(((n & 0xF) - (ctx->fetched_data & 0xF) - c) < 0);
+				CPU_SET_FLAG_C((n - ctx->fetched_data - c) < 0);
+				CPU_SET_FLAG_N(1);
+				ctx->cycles += 2;
 			}
-
-			CPU_SET_FLAG_H(((n & 0xF) - (ctx.fetched_data & 0xF) - c) < 0);
-			CPU_SET_FLAG_C((n - ctx.fetched_data - c) < 0);
-			CPU_SET_FLAG_N(1);
 		}
 		break;
 
 		case INSTRUCT_AND: {
-			u16 r = cpu_read_reg16(ctx.current_instruction.r_target) & ctx.fetched_data;
-			if (ctx.current_instruction.r_target < REG_AF) {
-				cpu_write_reg(ctx.current_instruction.r_target, r & 0xFF);
-				ctx.cycles += 1;
+			u16 r = cpu_read_reg16(gb, in->r_target) & ctx->fetched_data;
+			if (in->r_target < REG_AF) {
+				cpu_write_reg(gb, in->r_target, r & 0xFF);
+				ctx->cycles += 1;
 			} else {
-				cpu_write_reg16(ctx.current_instruction.r_target, r);
-				ctx.cycles += 2;
+				cpu_write_reg16(gb, in->r_target, r);
+				ctx->cycles += 2;
 			}
 
-			CPU_SET_FLAG_Z(r == 0);
-			CPU_SET_FLAG_N(0);
-			CPU_SET_FLAG_H(1);
-			CPU_SET_FLAG_C(0);
+			cpu_set_flags(gb, (r == 0 ? 0x80 : 0) | 0x20);
 		}
 		break;
 
 		case INSTRUCT_XOR: {
-			u8 r = (cpu_read_reg(ctx.current_instruction.r_target) ^ ctx.fetched_data) & 0xFF;
+			u8 r = (cpu_read_reg(gb, in->r_target) ^ ctx->fetched_data) & 0xFF;
 			// target is always REG_A
-			cpu_write_reg(ctx.current_instruction.r_target, r);
-			CPU_REG_F = 0;
-			CPU_SET_FLAG_Z(r == 0);
-			ctx.cycles += 1;
+			cpu_write_reg(gb, in->r_target, r);
+			cpu_set_flags(gb, r == 0 ? 0x80 : 0);
+			ctx->cycles += 1;
 		}
 		break;
 
 		case INSTRUCT_OR: {
-			u16 r = cpu_read_reg16(ctx.current_instruction.r_target) | ctx.fetched_data;
-			if (ctx.current_instruction.r_target < REG_AF) {
-				cpu_write_reg(ctx.current_instruction.r_target, r & 0xFF);
-				ctx.cycles += 1;
+			u16 r = cpu_read_reg16(gb, in->r_target) | ctx->fetched_data;
+			if (in->r_target < REG_AF) {
+				cpu_write_reg(gb, in->r_target, r & 0xFF);
+				ctx->cycles += 1;
 			} else {
-				cpu_write_reg16(ctx.current_instruction.r_target, r);
-				ctx.cycles += 2;
+				cpu_write_reg16(gb, in->r_target, r);
+				ctx->cycles += 2;
 			}
 
-			CPU_REG_F = 0;
-			CPU_SET_FLAG_Z(r == 0);
+			cpu_set_flags(gb, r == 0 ? 0x80 : 0);
 		}
 		break;
 
 		case INSTRUCT_CP: {
-			u16 n = cpu_read_reg16(ctx.current_instruction.r_target);
-			u16 r = n - ctx.fetched_data;
-			if (ctx.current_instruction.r_target < REG_AF)
-				ctx.cycles += 1;
-			else
-				ctx.cycles += 2;
-			CPU_SET_FLAG_Z(r == 0);
-			CPU_SET_FLAG_N(1);
-			CPU_SET_FLAG_H((n & 0xF) < (ctx.fetched_data & 0xF));
-			CPU_SET_FLAG_C(n < ctx.fetched_data);
+			u16 n = cpu_read_reg16(gb, in->r_target);
+			if (in->r_target < REG_AF) {
+				cpu_set_flags_lazy(gb, CPU_LAZY_SUB, n, ctx->fetched_data, 0);
+				ctx->cycles += 1;
+			} else {
+				u16 r = n - ctx->fetched_data;
+				CPU_SET_FLAG_Z(r == 0);
+				CPU_SET_FLAG_N(1);
+				CPU_SET_FLAG_H((n & 0xF) < (ctx->fetched_data & 0xF));
+				CPU_SET_FLAG_C(n < ctx->fetched_data);
+				ctx->cycles += 2;
+			}
 		}
 		break;
 
 		case INSTRUCT_LD:
-			ctx.cycles += 1;
-			cpu_execute_ld();
+			ctx->cycles += 1;
+			cpu_execute_ld(gb, in);
 		break;
 
 		case INSTRUCT_LDI:
-			ctx.cycles += 1;
-			cpu_execute_ld();
-			cpu_inc_reg(REG_HL);
+			ctx->cycles += 1;
+			cpu_execute_ld(gb, in);
+			cpu_inc_reg(gb, REG_HL);
 		break;
 
 		case INSTRUCT_LDD:
-			ctx.cycles += 1;
-			cpu_execute_ld();
-			cpu_dec_reg(REG_HL);
+			ctx->cycles += 1;
+			cpu_execute_ld(gb, in);
+			cpu_dec_reg(gb, REG_HL);
 		break;
 
 		case INSTRUCT_JP:
-			ctx.cycles += 1;
-			if (cpu_check_cond(ctx.current_instruction.flag)) {
-				ctx.cycles += 2;
-				ctx.registers.PC = ctx.fetched_data;
+			ctx->cycles += 1;
+			if (cpu_check_cond(gb, in->flag)) {
+				ctx->cycles += 2;
+				ctx->registers.PC = ctx->fetched_data;
 			} else {
-				ctx.cycles += 1;
+				ctx->cycles += 1;
 			}
 		break;
 
 		case INSTRUCT_JR:
-			if (cpu_check_cond(ctx.current_instruction.flag)) {
-				ctx.cycles += 3;
-				ctx.registers.PC += ctx.fetched_data;
+			if (cpu_check_cond(gb, in->flag)) {
+				ctx->cycles += 3;
+				ctx->registers.PC += ctx->fetched_data;
 			} else {
-				ctx.cycles += 2;
+				ctx->cycles += 2;
 			}
 		break;
 
 		case INSTRUCT_INC: {
-			ctx.cycles += 1;
-			bool carry = (ctx.fetched_data & 0xF) == 0xF;
-			ctx.fetched_data++;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, ctx.fetched_data);
+			ctx->cycles += 1;
+			ctx->fetched_data++;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, ctx->fetched_data);
 			else
-				cpu_inc_reg(ctx.current_instruction.r_target);
+				cpu_inc_reg(gb, in->r_target);
 
-			if (ctx.write_dst || ctx.current_instruction.r_target < REG_AF) {
-				CPU_SET_FLAG_Z((ctx.fetched_data & 0xFF) == 0);
-				CPU_SET_FLAG_N(0);
-				CPU_SET_FLAG_H(carry);
-			}
+			if (ctx->write_bus || in->r_target < REG_AF)
+				cpu_set_flags_lazy(gb, CPU_LAZY_INC, ctx->fetched_data, 0, CPU_FLAG_C);
 		}
 		break;
 
 		case INSTRUCT_DEC: {
-			ctx.cycles += 1;
-			ctx.fetched_data--;
-			bool carry = (ctx.fetched_data & 0xF) == 0xF;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, ctx.fetched_data);
+			ctx->cycles += 1;
+			ctx->fetched_data--;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, ctx->fetched_data);
 			else
-				cpu_dec_reg(ctx.current_instruction.r_target);
+				cpu_dec_reg(gb, in->r_target);
 
-			if (ctx.write_dst || ctx.current_instruction.r_target < REG_AF) {
-				CPU_SET_FLAG_Z((ctx.fetched_data & 0xFF) == 0);
-				CPU_SET_FLAG_N(1);
-				CPU_SET_FLAG_H(carry);
-			}
+			if (ctx->write_bus || in->r_target < REG_AF)
+				cpu_set_flags_lazy(gb, CPU_LAZY_DEC, ctx->fetched_data, 0, CPU_FLAG_C);
 		}
 		break;
 
 		case INSTRUCT_RST:
-			ctx.cycles += 4;
-			ctx.registers.SP -= 2;
-			bus_write16(ctx.registers.SP, ctx.registers.PC);
-			ctx.registers.PC = ctx.fetched_data;
+			ctx->cycles += 4;
+			ctx->registers.SP -= 2;
+			bus_write16(gb, ctx->registers.SP, ctx->registers.PC);
+			ctx->registers.PC = ctx->fetched_data;
 		break;
 
 		case INSTRUCT_RET:
-			ctx.cycles += 1;
-			if (cpu_check_cond(ctx.current_instruction.flag)) {
-				ctx.registers.PC = bus_read16(ctx.registers.SP);
-				ctx.registers.SP += 2;
+			ctx->cycles += 1;
+			if (cpu_check_cond(gb, in->flag)) {
+				ctx->registers.PC = bus_read16(gb, ctx->registers.SP);
+				ctx->registers.SP += 2;
 			}
 		break;
 
 		case INSTRUCT_RETI:
-			ctx.registers.PC = bus_read16(ctx.registers.SP);
-			ctx.registers.SP += 2;
-			ctx.enable_ime = true;
-			ctx.cycles += 1;
+			ctx->registers.PC = bus_read16(gb, ctx->registers.SP);
+			ctx->registers.SP += 2;
+			ctx->enable_ime = true;
+			ctx->cycles += 1;
 		break;
 
 		case INSTRUCT_CALL:
-			ctx.cycles += 2;
-			if (cpu_check_cond(ctx.current_instruction.flag)) {
-				ctx.registers.SP -= 2;
-				bus_write16(ctx.registers.SP, ctx.registers.PC);
-				ctx.registers.PC = ctx.fetched_data;
+			ctx->cycles += 2;
+			if (cpu_check_cond(gb, in->flag)) {
+				ctx->registers.SP -= 2;
+				bus_write16(gb, ctx->registers.SP, ctx->registers.PC);
+				ctx->registers.PC = ctx->fetched_data;
 			}
 		break;
 
 		case INSTRUCT_DI:
-			ctx.cycles += 1;
-			ctx.ime = false;
+			ctx->cycles += 1;
+			ctx->ime = false;
 		break;
 
 		case INSTRUCT_EI:
-			ctx.cycles += 1;
-			ctx.enable_ime = true;
+			ctx->cycles += 1;
+			ctx->enable_ime = true;
 		break;
 
 		case INSTRUCT_STOP:
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 			// only supported with CGB
-			if (bus_read(ADDR_KEY1) & 0x1) {
-				if (bus_read(ADDR_KEY1) & 0x80) {
-					bus_write(ADDR_KEY1, 0);
+			if (bus_read(gb, ADDR_KEY1) & 0x1) {
+				if (bus_read(gb, ADDR_KEY1) & 0x80) {
+					bus_write(gb, ADDR_KEY1, 0);
 				} else {
-					bus_write(ADDR_KEY1, 0x80);
+					bus_write(gb, ADDR_KEY1, 0x80);
 				}
 			}
 		break;
 
 		case INSTRUCT_RLCA: {
-			u8 c = (ctx.fetched_data & 0x80) >> 7;
-			u8 v = (ctx.fetched_data << 1) + c;
-			cpu_write_reg(ctx.current_instruction.r_target, v);
-			CPU_REG_F = 0;
+			u8 c = (ctx->fetched_data & 0x80) >> 7;
+			u8 v = (ctx->fetched_data << 1) + c;
+			cpu_write_reg(gb, in->r_target, v);
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_RLA: {
-			u8 c = (ctx.fetched_data & 0x80) >> 7;
-			cpu_write_reg(ctx.current_instruction.r_target, (ctx.fetched_data << 1) + CPU_FLAG_C);
-			CPU_REG_F = 0;
+			u8 c = (ctx->fetched_data & 0x80) >> 7;
+			cpu_write_reg(gb, in->r_target, (ctx->fetched_data << 1) + CPU_FLAG_C);
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_RRCA: {
-			u8 c = ctx.fetched_data & 0x1;
-			u8 v = (c << 7) | (ctx.fetched_data >> 1);
-			cpu_write_reg(ctx.current_instruction.r_target, v);
-			CPU_REG_F = 0;
+			u8 c = ctx->fetched_data & 0x1;
+			u8 v = (c << 7) | (ctx->fetched_data >> 1);
+			cpu_write_reg(gb, in->r_target, v);
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_RRA: {
-			u8 c = (ctx.fetched_data & 0x1);
-			u8 v = ((CPU_FLAG_C << 7) | (ctx.fetched_data >> 1)) & 0xFF;
-			cpu_write_reg(ctx.current_instruction.r_target, v);
-			CPU_REG_F = 0;
+			u8 c = (ctx->fetched_data & 0x1);
+			u8 v = ((CPU_FLAG_C << 7) | (ctx->fetched_data >> 1)) & 0xFF;
+			cpu_write_reg(gb, in->r_target, v);
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_POP: {
-			cpu_write_reg16(ctx.current_instruction.r_target, ctx.fetched_data);
-			if (ctx.current_instruction.r_target == REG_AF)
-				CPU_REG_F = ctx.fetched_data & 0xF0;
-			ctx.registers.SP += 2;
-			ctx.cycles += 3;
+			cpu_write_reg16(gb, in->r_target, ctx->fetched_data);
+			if (in->r_target == REG_AF)
+				cpu_set_flags(gb, ctx->fetched_data & 0xF0);
+			ctx->registers.SP += 2;
+			ctx->cycles += 3;
 		}
 		break;
 
 		case INSTRUCT_PUSH: {
-			ctx.registers.SP -= 2;
-			bus_write16(ctx.registers.SP, ctx.fetched_data);
-			ctx.cycles += 4;
+			ctx->registers.SP -= 2;
+			bus_write16(gb, ctx->registers.SP, ctx->fetched_data);
+			ctx->cycles += 4;
 		}
 		break;
 
@@ -611,7 +684,7 @@ void cpu_execute_instruction() {
 			}
 			CPU_SET_FLAG_Z(CPU_REG_A == 0);
 			CPU_SET_FLAG_H(0);
-			ctx.cycles += 1;
+			ctx->cycles += 1;
 		}
 		break;
 
@@ -619,7 +692,7 @@ void cpu_execute_instruction() {
 			CPU_REG_A = ~CPU_REG_A;
 			CPU_SET_FLAG_N(1);
 			CPU_SET_FLAG_H(1);
-			ctx.cycles += 1;
+			ctx->cycles += 1;
 		}
 		break;
 
@@ -627,7 +700,7 @@ void cpu_execute_instruction() {
 			CPU_SET_FLAG_N(0);
 			CPU_SET_FLAG_H(0);
 			CPU_SET_FLAG_C(1);
-			ctx.cycles += 1;
+			ctx->cycles += 1;
 		}
 		break;
 
@@ -635,203 +708,333 @@ void cpu_execute_instruction() {
 			CPU_SET_FLAG_N(0);
 			CPU_SET_FLAG_H(0);
 			CPU_SET_FLAG_C(!CPU_FLAG_C);
-			ctx.cycles += 1;
+			ctx->cycles += 1;
 		}
 		break;
 
 		case INSTRUCT_CB_SET: {
-			ctx.fetched_data |= (1 << ctx.current_instruction.parameter);
-			if (ctx.write_dst)
-				bus_write(ctx.write_dst, ctx.fetched_data & 0xff);
+			ctx->fetched_data |= (1 << in->parameter);
+			if (ctx->write_bus)
+				bus_write(gb, ctx->write_dst, ctx->fetched_data & 0xff);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, ctx.fetched_data & 0xff);
+				cpu_write_reg(gb, in->r_target, ctx->fetched_data & 0xff);
 
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_RES: {
-			ctx.fetched_data &= ~(1 << ctx.current_instruction.parameter);
-			if (ctx.write_dst)
-				bus_write(ctx.write_dst, ctx.fetched_data & 0xff);
+			ctx->fetched_data &= ~(1 << in->parameter);
+			if (ctx->write_bus)
+				bus_write(gb, ctx->write_dst, ctx->fetched_data & 0xff);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, ctx.fetched_data & 0xff);
+				cpu_write_reg(gb, in->r_target, ctx->fetched_data & 0xff);
 
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_BIT: {
-			u8 r = (ctx.fetched_data & (1 << ctx.current_instruction.parameter)) & 0xFF;
+			u8 r = (ctx->fetched_data & (1 << in->parameter)) & 0xFF;
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_N(0);
 			CPU_SET_FLAG_H(1);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_RLC: {
-			u8 c = (ctx.fetched_data & 0x80) >> 7;
-			u8 r = ((ctx.fetched_data << 1) & 0xFF) + c;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 c = (ctx->fetched_data & 0x80) >> 7;
+			u8 r = ((ctx->fetched_data << 1) & 0xFF) + c;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_RL: {
-			u8 c = (ctx.fetched_data & 0x80) >> 7;
-			u8 r = ((ctx.fetched_data << 1) & 0xFF) + CPU_FLAG_C;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 c = (ctx->fetched_data & 0x80) >> 7;
+			u8 r = ((ctx->fetched_data << 1) & 0xFF) + CPU_FLAG_C;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_RR: {
-			u8 c = (ctx.fetched_data & 0x1);
-			u8 r = ((CPU_FLAG_C << 7) | (ctx.fetched_data >> 1)) & 0xFF;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 c = (ctx->fetched_data & 0x1);
+			u8 r = ((CPU_FLAG_C << 7) | (ctx->fetched_data >> 1)) & 0xFF;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_RRC: {
-			u8 c = (ctx.fetched_data & 0x1);
-			u8 r = ((c << 7) | (ctx.fetched_data >> 1)) & 0xFF;
+			u8 c = (ctx->fetched_data & 0x1);
+			u8 r = ((c << 7) | (ctx->fetched_data >> 1)) & 0xFF;
 
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_SLA: {
-			u8 c = (ctx.fetched_data & 0x80) >> 7;
-			u8 r = (ctx.fetched_data << 1) & 0xFF;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 c = (ctx->fetched_data & 0x80) >> 7;
+			u8 r = (ctx->fetched_data << 1) & 0xFF;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_SRA: {
-			u8 c = (ctx.fetched_data & 0x1);
-			u8 r = ((ctx.fetched_data & 0x80) | (ctx.fetched_data >> 1)) & 0xFF;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 c = (ctx->fetched_data & 0x1);
+			u8 r = ((ctx->fetched_data & 0x80) | (ctx->fetched_data >> 1)) & 0xFF;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_SWAP: {
-			u8 r = ((ctx.fetched_data << 4) | (ctx.fetched_data >> 4)) & 0xFF;
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			u8 r = ((ctx->fetched_data << 4) | (ctx->fetched_data >> 4)) & 0xFF;
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		case INSTRUCT_CB_SRL: {
-			u8 c = (ctx.fetched_data & 0x1);
-			u8 r = (ctx.fetched_data >> 1) & 0xFF;
+			u8 c = (ctx->fetched_data & 0x1);
+			u8 r = (ctx->fetched_data >> 1) & 0xFF;
 
-			if (ctx.write_dst)
-				bus_write16(ctx.write_dst, r);
+			if (ctx->write_bus)
+				bus_write16(gb, ctx->write_dst, r);
 			else
-				cpu_write_reg(ctx.current_instruction.r_target, r);
+				cpu_write_reg(gb, in->r_target, r);
 
-			CPU_REG_F = 0;
+			cpu_set_flags(gb, 0);
 			CPU_SET_FLAG_Z(r == 0);
 			CPU_SET_FLAG_C(c);
-			ctx.cycles += 2;
+			ctx->cycles += 2;
 		}
 		break;
 
 		default:
-			// ctx.cycles++;
+			// ctx->cycles++;
 			fprintf(stderr, "ERR: CPU step not implemented\n");
 		break;
 	}
 }
 
-void cpu_init() {
-	cpu_write_reg16(REG_AF, 0x01B0);
-	cpu_write_reg16(REG_BC, 0x0013);
-	cpu_write_reg16(REG_DE, 0x00D8);
-	cpu_write_reg16(REG_HL, 0x014D);
+// switch interpreter, decodes the operands of the current instruction at runtime
+void cpu_fetch_data(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	cpu_fetch_data_op(gb, ctx->current_instruction);
+}
+
+void cpu_execute_instruction(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	cpu_execute_op(gb, ctx->current_instruction);
+}
+
+// threaded dispatch: one handler per opcode generated from instructions[],
+// the constant table entry lets the compiler fold the mode/type switches and
+// register lookups into a specialized body
+#define CPU_OP_HANDLER(op) \
+	static void cpu_op_##op(gbc_machine *gb) { \
+		cpu_fetch_data_op(gb, &instructions[op]); \
+		cpu_execute_op(gb, &instructions[op]); \
+	}
+#define CPU_OP_ENTRY(op) [op] = cpu_op_##op,
+
+#define CPU_OP_ROW(X, r) \
+	X(r##0) X(r##1) X(r##2) X(r##3) X(r##4) X(r##5) X(r##6) X(r##7) \
+	X(r##8) X(r##9) X(r##A) X(r##B) X(r##C) X(r##D) X(r##E) X(r##F)
+#define CPU_OP_TABLE(X) \
+	CPU_OP_ROW(X, 0x0)  CPU_OP_ROW(X, 0x1)  CPU_OP_ROW(X, 0x2)  CPU_OP_ROW(X, 0x3) \
+	CPU_OP_ROW(X, 0x4)  CPU_OP_ROW(X, 0x5)  CPU_OP_ROW(X, 0x6)  CPU_OP_ROW(X, 0x7) \
+	CPU_OP_ROW(X, 0x8)  CPU_OP_ROW(X, 0x9)  CPU_OP_ROW(X, 0xA)  CPU_OP_ROW(X, 0xB) \
+	CPU_OP_ROW(X, 0xC)  CPU_OP_ROW(X, 0xD)  CPU_OP_ROW(X, 0xE)  CPU_OP_ROW(X, 0xF) \
+	CPU_OP_ROW(X, 0x10) CPU_OP_ROW(X, 0x11) CPU_OP_ROW(X, 0x12) CPU_OP_ROW(X, 0x13) \
+	CPU_OP_ROW(X, 0x14) CPU_OP_ROW(X, 0x15) CPU_OP_ROW(X, 0x16) CPU_OP_ROW(X, 0x17) \
+	CPU_OP_ROW(X, 0x18) CPU_OP_ROW(X, 0x19) CPU_OP_ROW(X, 0x1A) CPU_OP_ROW(X, 0x1B) \
+	CPU_OP_ROW(X, 0x1C) CPU_OP_ROW(X, 0x1D) CPU_OP_ROW(X, 0x1E) CPU_OP_ROW(X, 0x1F)
+
+CPU_OP_TABLE(CPU_OP_HANDLER)
+
+static const cpu_op_handler cpu_op_handlers[0x200] = {
+	CPU_OP_TABLE(CPU_OP_ENTRY)
+};
+
+void cpu_set_dispatch_mode(gbc_machine *gb, cpu_dispatch_mode mode) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->dispatch_mode = mode;
+}
+
+u8 cpu_operand_length(const cpu_instruction *instruction) {
+	switch (instruction->mode) {
+		case MODE_U8:
+		case MODE_D8:
+		case MODE_U8_TO_REG:
+		case MODE_D8_TO_ADDR:
+		case MODE_D8_TO_REG:
+		case MODE_A8_TO_REG:
+		case MODE_REG_TO_A8:
+			return 1;
+		case MODE_U16:
+		case MODE_A16:
+		case MODE_A16_TO_REG:
+		case MODE_D16_TO_REG:
+			return 2;
+		case MODE_REG_TO_ADDR:
+		case MODE_REG_TO_IOADDR:
+			if (instruction->r_target)
+				return 0;
+			return instruction->byte_length > 2 ? 2 : 1;
+		default:
+			return 0;
+	}
+}
+
+void cpu_decode(gbc_machine *gb, cpu_decoded_instruction *d, u16 pc) {
+	d->pc = pc;
+	d->opcode = bus_fetch(gb, pc);
+	d->length = 1;
+
+	u16 index = d->opcode;
+	if (d->opcode == 0xCB)
+		index = 0x100 + bus_read(gb, pc + d->length++);
+	d->instruction = &instructions[index];
+	d->handler = cpu_op_handlers[index];
+
+	u8 operands = cpu_operand_length(d->instruction);
+	d->imm = 0;
+	if (operands > 0)
+		d->imm = bus_read(gb, pc + d->length);
+	if (operands > 1)
+		d->imm |= bus_read(gb, pc + d->length + 1) << 8;
+	d->length += operands;
+}
+
+void cpu_fetch_instruction(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	u16 pc = ctx->registers.PC;
+	cpu_decoded_instruction *d = &ctx->decode_scratch;
+
+	if (pc < CPU_DECODE_CACHE_SIZE) {
+		// rom is immutable for a given bank, so only a bank switch invalidates
+		d = &ctx->decode_cache[pc];
+		u16 tag = bus_rom_bank(gb, pc) + 1;
+		if (d->bank_tag != tag) {
+			cpu_decode(gb, d, pc);
+			// don't keep instructions spanning a bank window boundary, or on
+			// pages trapped for watchpoints or profiling that see every fetch
+			d->bank_tag = ((pc ^ (pc + d->length - 1)) & 0xC000) || (bus_page_traps(gb, pc) & BUS_TRAPS_FETCH) ? 0 : tag;
+		}
+	} else {
+		// writable memory (vram, wram, hram) is decoded fresh on every fetch
+		cpu_decode(gb, d, pc);
+	}
+
+	ctx->decoded = d;
+	ctx->current_opcode = d->opcode;
+	ctx->current_instruction = d->instruction;
+	ctx->registers.PC += d->length;
 
-	ctx.registers.PC = 0x100;
-	ctx.registers.SP = 0xFFFE;
+	ctx->fetched_data = 0;
+	ctx->write_dst = 0;
+	ctx->write_bus = false;
 }
 
-void cpu_debug() {
+static void cpu_write_if(gbc_machine *gb, u16 addr, u8 val) {
+	// upper bits always read back set
+	bus_io_write_mem(gb, addr, 0xE0 | val);
+}
+
+void cpu_init(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	cpu_write_reg16(gb, REG_AF, 0x01B0);
+	cpu_write_reg16(gb, REG_BC, 0x0013);
+	cpu_write_reg16(gb, REG_DE, 0x00D8);
+	cpu_write_reg16(gb, REG_HL, 0x014D);
+
+	ctx->registers.PC = 0x100;
+	ctx->registers.SP = 0xFFFE;
+
+	bus_register_io(gb, ADDR_IF, NULL, cpu_write_if);
+}
+
+void cpu_debug(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
 	// game boy doctor format
 	printf("A:%02X F:%02X B:%02X C:%02X D:%02X E:%02X H:%02X L:%02X SP:%04X PC:%04X PCMEM:%02X,%02X,%02X,%02X\n",
-		cpu_read_reg(REG_A), cpu_read_reg(REG_F), cpu_read_reg(REG_B), cpu_read_reg(REG_C), cpu_read_reg(REG_D), cpu_read_reg(REG_E), cpu_read_reg(REG_H), cpu_read_reg(REG_L), ctx.registers.SP, ctx.registers.PC,
-		bus_read(ctx.registers.PC), bus_read(ctx.registers.PC + 1), bus_read(ctx.registers.PC + 2), bus_read(ctx.registers.PC + 3)
+		cpu_read_reg(gb, REG_A), cpu_read_reg(gb, REG_F), cpu_read_reg(gb, REG_B), cpu_read_reg(gb, REG_C), cpu_read_reg(gb, REG_D), cpu_read_reg(gb, REG_E), cpu_read_reg(gb, REG_H), cpu_read_reg(gb, REG_L), ctx->registers.SP, ctx->registers.PC,
+		bus_read(gb, ctx->registers.PC), bus_read(gb, ctx->registers.PC + 1), bus_read(gb, ctx->registers.PC + 2), bus_read(gb, ctx->registers.PC + 3)
 	);
 
     // printf("PC: 0x%04X (%02X %02X %02X %02X) | AF: %02X%02X, BC: %02X%02X, DE: %02X%02X, HL: %02X%02X, SP: %04X, cycles: %04d | FLAGS Z=%d N=%d H=%d C=%d | DIV: %02X | TIMA: %02X | TMA: %02X | TAC: %02X\n",
-    //    ctx.registers.PC,
-    //    bus_read(ctx.registers.PC),
-    //    bus_read(ctx.registers.PC+1),
-    //    bus_read(ctx.registers.PC+2),
-    //    bus_read(ctx.registers.PC+3),
-    //    cpu_read_reg(REG_A), cpu_read_reg(REG_F), cpu_read_reg(REG_B), cpu_read_reg(REG_C), cpu_read_reg(REG_D), cpu_read_reg(REG_E), cpu_read_reg(REG_H), cpu_read_reg(REG_L), ctx.registers.SP, ctx.cycles,
+    //    ctx->registers.PC,
+    //    bus_read(gb, ctx->registers.PC),
+    //    bus_read(gb, ctx->registers.PC+1),
+    //    bus_read(gb, ctx->registers.PC+2),
+    //    bus_read(gb, ctx->registers.PC+3),
+    //    cpu_read_reg(gb, REG_A), cpu_read_reg(gb, REG_F), cpu_read_reg(gb, REG_B), cpu_read_reg(gb, REG_C), cpu_read_reg(gb, REG_D), cpu_read_reg(gb, REG_E), cpu_read_reg(gb, REG_H), cpu_read_reg(gb, REG_L), ctx->registers.SP, ctx->cycles,
     //    CPU_FLAG_Z, CPU_FLAG_N, CPU_FLAG_H, CPU_FLAG_C,
-    //    timer_read(ADDR_DIV), timer_read(ADDR_TIMA), timer_read(ADDR_TMA), timer_read(ADDR_TAC));
+    //    timer_read(gb, ADDR_DIV), timer_read(gb, ADDR_TIMA), timer_read(gb, ADDR_TMA), timer_read(gb, ADDR_TAC));
 }
 
-u8 cpu_execute_interrupts() {
-	if (!ctx.ime)
+u8 cpu_execute_interrupts(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	if (!ctx->ime)
 		return 0;
 
 	u8 interrupt_addr = 0, interrupt_flag = 0, cycles = 0;
-	u8 ie = bus_read(ADDR_IE);
-	u8 ifs = bus_read(ADDR_IF);
+	u8 ie = bus_read(gb, ADDR_IE);
+	u8 ifs = bus_read(gb, ADDR_IF);
 
 	if ((ie & INTERRUPT_VBLANK) && (ifs & INTERRUPT_VBLANK)) {
 		interrupt_addr = 0x40;
@@ -851,45 +1054,104 @@ u8 cpu_execute_interrupts() {
 	}
 
 	if (interrupt_addr && interrupt_flag) {
-		ctx.ime = false;
-		ctx.registers.PC -= 2;
-		ctx.registers.SP = ctx.registers.PC;
-		ctx.registers.PC = interrupt_addr;
-		cycles = 20;
-		bus_write(ADDR_IF, ifs & ~interrupt_flag);
+		// pc already points at the next instruction, that is the return address
+		ctx->ime = false;
+		ctx->registers.SP -= 2;
+		bus_write16(gb, ctx->registers.SP, ctx->registers.PC);
+		ctx->registers.PC = interrupt_addr;
+		cycles = 5;
+		bus_write(gb, ADDR_IF, ifs & ~interrupt_flag);
 	}
 
 	return cycles;
 }
 
-u32 cpu_step() {
-	ctx.cycles = 0;
+static ALWAYS_INLINE bool cpu_halt_wakeup(gbc_machine *gb) {
+	// any enabled pending interrupt wakes the cpu, ime only decides whether
+	// it is serviced; the unused upper bits of if always read set
+	u8 ifs = bus_read(gb, ADDR_IF);
+	u8 ie = bus_read(gb, ADDR_IE);
+	return ifs & ie & 0x1F;
+}
+
+static ALWAYS_INLINE u32 cpu_step_instruction(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->cycles = 0;
+
+	if (ctx->halted) {
+		if (cpu_halt_wakeup(gb))
+			ctx->halted = false;
+		ctx->ticks += ++ctx->cycles;
+		return ctx->cycles;
+	}
+
+	if (ctx->ime)
+		ctx->cycles += cpu_execute_interrupts(gb);
 
-	if (ctx.halted) {
-		// TODO: handle halt bug
-		u8 ifs = bus_read(ADDR_IF);
-		u8 ie = bus_read(ADDR_IE);
-		if (ctx.ime && ifs && ie)
-			ctx.halted = false;
-		return ++ctx.cycles;
+	if (ctx->enable_ime) {
+		ctx->ime = true;
+		ctx->enable_ime = false;
+	}
+
+	cpu_fetch_instruction(gb);
+	if (ctx->dispatch_mode == CPU_DISPATCH_SWITCH) {
+		cpu_fetch_data(gb);
+		cpu_execute_instruction(gb);
+	} else {
+		ctx->decoded->handler(gb);
 	}
 
-	if (ctx.ime)
-		ctx.cycles += cpu_execute_interrupts();
+	ctx->ticks += ctx->cycles;
+	return ctx->cycles;
+}
+
+u32 cpu_step(gbc_machine *gb) {
+	return cpu_step_instruction(gb);
+}
+
+u32 cpu_run_until(gbc_machine *gb, u64 target_cycle) {
+	cpu_context *ctx = &gb->cpu;
+	u64 start = ctx->ticks;
+	ctx->yield = false;
 
-	if (ctx.enable_ime) {
-		ctx.ime = true;
-		ctx.enable_ime = false;
+	while (ctx->ticks < target_cycle && !ctx->yield) {
+		if (ctx->halted && !cpu_halt_wakeup(gb)) {
+			// only a hardware event can wake the cpu, skip ahead to it
+			ctx->ticks = target_cycle;
+			break;
+		}
+		cpu_step_instruction(gb);
 	}
 
-	cpu_fetch_instruction();
-	cpu_fetch_data();
-	cpu_execute_instruction();
+	return ctx->ticks - start;
+}
+
+void cpu_yield(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	ctx->yield = true;
+}
+
+void cpu_stall(gbc_machine *gb, u32 cycles) {
+	gb->cpu.ticks += cycles;
+}
+
+u16 cpu_instruction_pc(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	return ctx->decoded ? ctx->decoded->pc : ctx->registers.PC;
+}
+
+void cpu_flush_decode_cache(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	for (u32 pc = 0; pc < CPU_DECODE_CACHE_SIZE; pc++)
+		ctx->decode_cache[pc].bank_tag = 0;
+}
 
-	return ctx.cycles;
+u64 cpu_get_ticks(gbc_machine *gb) {
+	cpu_context *ctx = &gb->cpu;
+	return ctx->ticks;
 }
 
-void cpu_request_interrupt(u8 i) {
-	u8 r = bus_read(ADDR_IF) | i;
-	bus_write(ADDR_IF, r);
+void cpu_request_interrupt(gbc_machine *gb, u8 i) {
+	u8 r = bus_read(gb, ADDR_IF) | i;
+	bus_write(gb, ADDR_IF, r);
 }
@@ -3,14 +3,18 @@
 #include "common.h"
 #include "cart.h"
 #include "cpu.h"
+#include "mbc.h"
 #include "bus.h"
 #include "gui.h"
+#include "hdma.h"
 #include "ppu.h"
+#include "scheduler.h"
+#include "serial.h"
 #include "timer.h"
-#include "interrupt.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include <SDL.h>
@@ -21,60 +25,217 @@
         - bus
         - cart
         - gui
+        - hdma
         - cpu
+        - mbc
+        - pixel
         - ppu
+        - profile
+        - rtc
+        - scheduler
+        - serial
+        - tiles
         - timer
+        - watch
 */
 
-static gbc_context ctx = {0};
+// longest the cpu runs without returning to the loop, one frame
+#define GBC_MAX_SLICE_CYCLES 17556
+#define GBC_CYCLES_PER_SECOND 1048576
 
-gbc_context* gbc_get_context() {
-    return &ctx;
+gbc_context* gbc_get_context(gbc_machine *gb) {
+    return &gb->gbc;
+}
+
+static void gbc_sys_init(gbc_machine *gb) {
+    gbc_context *ctx = &gb->gbc;
+    ctx->ticks = 0;
+    ctx->cycles = 0;
+
+    scheduler_init(gb);
+    mbc_init(gb, get_cart_context(gb));
+    cpu_init(gb);
+    timer_init(gb);
+    serial_init(gb);
+    tiles_init(gb);
+    ppu_init(gb);
+    hdma_init(gb);
+    watch_init(gb);
+}
+
+gbc_machine *gbc_machine_create(const char *rom_filepath) {
+    gbc_machine *gb = calloc(1, sizeof(gbc_machine));
+    if (gb == NULL) {
+        fprintf(stderr, "memory allocation failed!\n");
+        return NULL;
+    }
+
+    // load cartridge / rom
+    if (!cart_init(gb, rom_filepath)) {
+        fprintf(stderr, "ERR: cartridge load failure\n");
+        free(gb);
+        return NULL;
+    }
+    // cart_debug(gb);
+    // before the bus maps its first banks, they are counted
+    profile_init(gb);
+    bus_init(gb, get_cart_context(gb));
+    gbc_sys_init(gb);
+    return gb;
+}
+
+void gbc_machine_destroy(gbc_machine *gb) {
+    if (gb == NULL)
+        return;
+    profile_dump(gb);
+    mbc_shutdown(gb);
+    bus_shutdown(gb);
+    cart_shutdown(gb);
+    free(gb);
+}
+
+void gbc_machine_step(gbc_machine *gb, u64 limit) {
+    gbc_context *ctx = &gb->gbc;
+    u32 cycles = 0;
+
+    if (ctx->debug_mode) {
+        cpu_debug(gb);
+        cycles = cpu_step(gb);
+    } else {
+        u64 target = scheduler_next(gb);
+        u64 max_target = cpu_get_ticks(gb) + GBC_MAX_SLICE_CYCLES;
+        if (max_target < target)
+            target = max_target;
+        if (limit < target)
+            target = limit;
+        cycles = cpu_run_until(gb, target);
+    }
+
+    scheduler_run(gb, cpu_get_ticks(gb));
+    ctx->cycles += cycles;
 }
 
 int gbc_sys_run(void* data) {
-    ctx.debug_mode = true;
-    ctx.ticks = 0;
-    ctx.running = true;
-
-    cpu_init();
-    timer_init();
-    ppu_init();    
-
-    while (ctx.running) {
-        int cycles = 0;
-
-        if (ctx.debug_mode)
-            cpu_debug();
-        
-        ppu_tick();
-        cycles += cpu_step();
-        if (timer_tick())
-            cpu_request_interrupt(INTERRUPT_TIMER);
+    gbc_machine *gb = data;
+
+    while (gb->gbc.running)
+        gbc_machine_step(gb, SCHED_NEVER);
+    return 0;
+}
+
+static double gbc_time_seconds() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool gbc_dump_framebuffer(gbc_machine *gb, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Failed to open framebuffer dump file.");
+        return false;
+    }
+
+    const u8 *fb = ppu_get_framebuffer(gb);
+    const char *ext = strrchr(path, '.');
+    if (ext && strcmp(ext, ".ppm") == 0) {
+        fprintf(file, "P6\n%d %d\n255\n", PPU_SCREEN_WIDTH, PPU_SCREEN_HEIGHT);
+        for (int i = 0; i < PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT; i++) {
+            u32 color = ppu_shade_colors[fb[i] & 0x3];
+            u8 rgb[3] = { (color >> 16) & 0xFF, (color >> 8) & 0xFF, color & 0xFF };
+            fwrite(rgb, sizeof(rgb), 1, file);
+        }
+    } else {
+        // raw shade indices, one byte per pixel
+        fwrite(fb, PPU_SCREEN_WIDTH * PPU_SCREEN_HEIGHT, 1, file);
     }
+
+    fclose(file);
+    return true;
+}
+
+// out_0042.ppm for frame 42 of out.ppm
+static void gbc_dump_frame(gbc_machine *gb, const char *path, u64 frame) {
+    char frame_path[1024];
+    const char *ext = strrchr(path, '.');
+    int stem = ext ? (int)(ext - path) : (int)strlen(path);
+    snprintf(frame_path, sizeof(frame_path), "%.*s_%04llu%s", stem, path, (unsigned long long)frame, ext ? ext : "");
+    gbc_dump_framebuffer(gb, frame_path);
+}
+
+static int gbc_run_headless(gbc_machine *gb, const gbc_options *options) {
+    gbc_context *ctx = &gb->gbc;
+    u64 cycle_limit = options->cycles ? options->cycles : SCHED_NEVER;
+    u64 frame = ppu_get_frame_count(gb);
+    double start = gbc_time_seconds();
+
+    while (ctx->running) {
+        gbc_machine_step(gb, cycle_limit);
+
+        if (ppu_get_frame_count(gb) != frame) {
+            frame = ppu_get_frame_count(gb);
+            if (options->dump_path && options->dump_every && frame % options->dump_every == 0)
+                gbc_dump_frame(gb, options->dump_path, frame);
+        }
+
+        if (options->frames && frame >= options->frames)
+            ctx->running = false;
+        if (cpu_get_ticks(gb) >= cycle_limit)
+            ctx->running = false;
+    }
+
+    double elapsed = gbc_time_seconds() - start;
+    if (options->dump_path)
+        gbc_dump_framebuffer(gb, options->dump_path);
+
+    printf("frames: %llu, cycles: %llu, time: %.3f s, %.1f fps, %.1fx speed\n",
+        (unsigned long long)frame, (unsigned long long)cpu_get_ticks(gb), elapsed,
+        elapsed > 0 ? frame / elapsed : 0.0,
+        elapsed > 0 ? (cpu_get_ticks(gb) / (double)GBC_CYCLES_PER_SECOND) / elapsed : 0.0);
     return 0;
 }
 
-int gbc_run(const char *rom_filepath) {
-    // load cartridge / rom
-    if (!cart_init(rom_filepath)) {
-        fprintf(stderr, "ERR: cartridge load failure\n");
+int gbc_run(const char *rom_filepath, const gbc_options *options) {
+    gbc_machine *gb = gbc_machine_create(rom_filepath);
+    if (gb == NULL)
         return -1;
+
+    gbc_context *ctx = &gb->gbc;
+    ctx->debug_mode = options->trace;
+    ctx->running = true;
+    if (options->switch_dispatch)
+        cpu_set_dispatch_mode(gb, CPU_DISPATCH_SWITCH);
+    if (options->rtc_cycles)
+        rtc_set_clock(gb, RTC_CLOCK_CYCLES);
+    for (u32 i = 0; i < options->watch_count; i++)
+        watch_add(gb, options->watches[i].start, options->watches[i].end, options->watches[i].kinds);
+    if (options->profile_path)
+        profile_enable(gb, options->profile_path);
+
+    if (options->bench_bus) {
+        bus_benchmark(gb);
+        gbc_machine_destroy(gb);
+        return 0;
+    }
+
+    if (options->headless) {
+        int r = gbc_run_headless(gb, options);
+        gbc_machine_destroy(gb);
+        return r;
     }
-    // cart_debug();
-    cart_context *cart_ctx = get_cart_context();
-    bus_init(cart_ctx);
 
     // System
-    SDL_CreateThread(gbc_sys_run, "gbc cpu", NULL);
+    SDL_Thread *thread = SDL_CreateThread(gbc_sys_run, "gbc cpu", gb);
 
     // UI
-    gui_init();
-    while (ctx.running) {
+    gui_init(gb);
+    while (ctx->running) {
         SDL_Delay(1);
         gui_tick();
-        ctx.running = !(gui_handle_input() & GUI_QUIT);
+        ctx->running = !(gui_handle_input() & GUI_QUIT);
     }
 
+    SDL_WaitThread(thread, NULL);
+    gbc_machine_destroy(gb);
     return 0;
 }
@@ -1,12 +1,18 @@
 #include "gui.h"
 #include "bus.h"
+#include "ppu.h"
+#include "gbc.h"
+#include "tiles.h"
 
 #include <stdio.h>
 #include <SDL.h>
 
 typedef struct {
+	gbc_machine *gb; // machine shown in the windows
+
 	SDL_Window *window;
 	SDL_Renderer *renderer;
+	SDL_Texture *screenTexture;
 
 	SDL_Window *dbgWindow;
 	SDL_Renderer *dbgRenderer;
@@ -16,19 +22,16 @@ typedef struct {
 
 static const u32 SCREEN_WIDTH = 160;
 static const u32 SCREEN_HEIGHT = 144;
-static const u16 TILE_SIZE = 16;
 static int scale = 4;
 
 static gui_context ctx = {0};
 
-//static unsigned long color_palette[4] = {0xFF000000, 0xFF000000, 0xFF000000, 0xFF000000}; // black + white
-static unsigned long color_palette[4] = { 0xFF9BBC0F, 0xFF8BAC0F, 0xFF306230, 0xFF0F380F }; // greenish
-
 SDL_Surface* gui_get_surface() {
 	return SDL_GetWindowSurface(ctx.window);
 }
 
-void gui_init() {
+void gui_init(gbc_machine *gb) {
+	ctx.gb = gb;
 	SDL_Init(SDL_INIT_EVERYTHING);
 
 	ctx.window = SDL_CreateWindow(
@@ -37,6 +40,8 @@ void gui_init() {
 		SCREEN_WIDTH * scale, SCREEN_HEIGHT * scale,
 		SDL_WINDOW_SHOWN);
 	ctx.renderer = SDL_CreateRenderer(ctx.window, 0, SDL_RENDERER_ACCELERATED);
+	ctx.screenTexture = SDL_CreateTexture(ctx.renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+		PPU_SCREEN_WIDTH, PPU_SCREEN_HEIGHT);
 
 	SDL_CreateWindowAndRenderer(16 * 8 * scale, 32 * 8 * scale, 0, &ctx.dbgWindow, &ctx.dbgRenderer);
 	ctx.dbgSurface = SDL_CreateRGBSurface(0,
@@ -52,22 +57,60 @@ void gui_init() {
 	SDL_SetWindowTitle(ctx.dbgWindow, "gbc debug view");
 }
 
-void gui_render_tile(SDL_Surface *surface, u16 addr, u16 tile_idx, u16 x, u16 y) {
+void gui_render_tile(SDL_Surface *surface, u16 tile_idx, u16 x, u16 y) {
 	SDL_Rect rc = {0};
-	for (int tile_y = 0; tile_y < TILE_SIZE; tile_y += 2) {
-		u8 tile1 = bus_read(addr + tile_idx * TILE_SIZE + tile_y);
-		u8 tile2 = bus_read(addr + tile_idx * TILE_SIZE + tile_y + 1);
-		for (int bit = 7; bit >= 0; --bit) {
-			u8 hi = !!(tile1 & (1 << bit)) << 1;
-			u8 lo = !!(tile2 & (1 << bit));
-			u8 color = hi | lo;
-			rc.x = x + (7 - bit) * scale;
-			rc.y = y + (tile_y / 2 * scale);
-			rc.w = scale;
-			rc.h = scale;
-			SDL_FillRect(surface, &rc, color_palette[color]);
+	rc.w = scale;
+	rc.h = scale;
+	for (int tile_y = 0; tile_y < 8; tile_y++) {
+		const u8 *row = tiles_row(&ctx.gb->tiles, tile_idx, tile_y, false);
+		for (int tile_x = 0; tile_x < 8; tile_x++) {
+			rc.x = x + tile_x * scale;
+			rc.y = y + tile_y * scale;
+			SDL_FillRect(surface, &rc, ppu_shade_colors[row[tile_x]]);
+		}
+	}
+}
+
+// log scale 0-255 of count against the largest count
+static u8 gui_heat(u64 count, u64 max) {
+	if (!count || !max)
+		return 0;
+	u32 bits = 0, max_bits = 0;
+	while (count >> bits)
+		bits++;
+	while (max >> max_bits)
+		max_bits++;
+	return 0x40 + (bits * 0xBF) / max_bits;
+}
+
+// one cell per 256 byte page, 16 pages per row; red writes, green reads,
+// blue instruction fetches
+static void gui_render_heatmap(SDL_Surface *surface, int y) {
+	const profile_context *prof = &ctx.gb->profile;
+	if (!prof->enabled)
+		return;
+
+	u64 max[PROFILE_COUNTER_COUNT] = {0};
+	for (u32 page = 0; page < 0x100; page++) {
+		for (u32 i = PROFILE_READ; i <= PROFILE_FETCH; i++) {
+			if (prof->pages[page][i] > max[i])
+				max[i] = prof->pages[page][i];
 		}
 	}
+
+	SDL_Rect rc = {0};
+	rc.w = surface->w / 16;
+	rc.h = (surface->h - y) / 16;
+	for (u32 page = 0; page < 0x100; page++) {
+		const u64 *counts = prof->pages[page];
+		rc.x = (page % 16) * rc.w;
+		rc.y = y + (page / 16) * rc.h;
+		u32 color = 0xFF000000
+			| (gui_heat(counts[PROFILE_WRITE], max[PROFILE_WRITE]) << 16)
+			| (gui_heat(counts[PROFILE_READ], max[PROFILE_READ]) << 8)
+			| gui_heat(counts[PROFILE_FETCH], max[PROFILE_FETCH]);
+		SDL_FillRect(surface, &rc, color);
+	}
 }
 
 void gui_dbg_window_tick() {
@@ -84,7 +127,7 @@ void gui_dbg_window_tick() {
 
 	for (int y = 0; y < 24; ++y) {
 		for (int x = 0; x < 16; ++x) {
-			gui_render_tile(ctx.dbgSurface, 0x8000, tile, x_draw + (x * scale), y_draw + (y * scale));
+			gui_render_tile(ctx.dbgSurface, tile, x_draw + (x * scale), y_draw + (y * scale));
 			x_draw += (scale * 8);
 			tile++;
 		}
@@ -92,6 +135,8 @@ void gui_dbg_window_tick() {
 		x_draw = 0;
 	}
 
+	gui_render_heatmap(ctx.dbgSurface, y_draw);
+
 	SDL_UpdateTexture(ctx.dbgTexture, NULL, ctx.dbgSurface->pixels, ctx.dbgSurface->pitch);
 	SDL_RenderClear(ctx.dbgRenderer);
 	SDL_RenderCopy(ctx.dbgRenderer, ctx.dbgTexture, NULL, NULL);
@@ -99,7 +144,24 @@ void gui_dbg_window_tick() {
 }
 
 void gui_gbc_window_tick() {
-	// TODO
+	// shades straight from the ppu's framebuffer into the texture; this is
+	// the gui thread, which must not render, so the lines of the frame in
+	// progress that are still pending show the previous frame
+	const u8 *fb = ctx.gb->ppu.framebuffer;
+	void *pixels;
+	int pitch;
+	if (SDL_LockTexture(ctx.screenTexture, NULL, &pixels, &pitch) != 0)
+		return;
+	for (int y = 0; y < PPU_SCREEN_HEIGHT; y++) {
+		u32 *row = (u32 *)((u8 *)pixels + y * pitch);
+		for (int x = 0; x < PPU_SCREEN_WIDTH; x++)
+			row[x] = ppu_shade_colors[fb[y * PPU_SCREEN_WIDTH + x] & 3];
+	}
+	SDL_UnlockTexture(ctx.screenTexture);
+
+	SDL_RenderClear(ctx.renderer);
+	SDL_RenderCopy(ctx.renderer, ctx.screenTexture, NULL, NULL);
+	SDL_RenderPresent(ctx.renderer);
 }
 
 void gui_tick() {
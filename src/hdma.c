@@ -0,0 +1,105 @@
+#include "hdma.h"
+#include "gbc.h"
+
+#include <string.h>
+
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+
+#define HDMA_BLOCK_SIZE 0x10
+// cpu cycles the cpu is halted for per block (single speed)
+#define HDMA_BLOCK_CYCLES 8
+
+// copy one block, the 16 byte aligned source and destination never cross a
+// bus page so the whole block is a single copy out of the resolved page
+static void hdma_copy_block(gbc_machine *gb) {
+	hdma_context *ctx = &gb->hdma;
+	u16 dst = 0x8000 | (ctx->dst & 0x1FF0);
+	const u8 *src_page = bus_read_page(gb, ctx->src);
+
+	if (src_page) {
+		bus_dma_write(gb, dst, src_page + (ctx->src & 0xFF), HDMA_BLOCK_SIZE);
+	} else {
+		// handler backed source (cart ram through the mbc), read as a
+		// separate bus master like the page copy above
+		u8 block[HDMA_BLOCK_SIZE];
+		for (u16 i = 0; i < HDMA_BLOCK_SIZE; i++)
+			block[i] = bus_dma_read(gb, ctx->src + i);
+		bus_dma_write(gb, dst, block, HDMA_BLOCK_SIZE);
+	}
+
+	ctx->src += HDMA_BLOCK_SIZE;
+	ctx->dst += HDMA_BLOCK_SIZE;
+	cpu_stall(gb, HDMA_BLOCK_CYCLES);
+}
+
+void hdma_hblank(gbc_machine *gb) {
+	hdma_context *ctx = &gb->hdma;
+	if (!ctx->active)
+		return;
+
+	hdma_copy_block(gb);
+	if (--ctx->blocks == 0)
+		ctx->active = false;
+}
+
+static u8 hdma_read(gbc_machine *gb, u16 addr) {
+	hdma_context *ctx = &gb->hdma;
+	if (addr != ADDR_HDMA5)
+		return 0xFF;
+	// blocks left - 1, bit 7 set once nothing is running; a cancelled
+	// transfer keeps its count so it can be resumed, a finished one reads 0xFF
+	u8 left = (ctx->blocks - 1) & 0x7F;
+	return ctx->active ? left : 0x80 | left;
+}
+
+static void hdma_write(gbc_machine *gb, u16 addr, u8 val) {
+	hdma_context *ctx = &gb->hdma;
+	switch (addr) {
+		case ADDR_HDMA1:
+			ctx->src = (ctx->src & 0x00FF) | (val << 8);
+		break;
+		case ADDR_HDMA2:
+			ctx->src = (ctx->src & 0xFF00) | (val & 0xF0);
+		break;
+		case ADDR_HDMA3:
+			ctx->dst = (ctx->dst & 0x00FF) | ((val & 0x1F) << 8);
+		break;
+		case ADDR_HDMA4:
+			ctx->dst = (ctx->dst & 0xFF00) | (val & 0xF0);
+		break;
+		case ADDR_HDMA5: {
+			u8 blocks = (val & 0x7F) + 1;
+
+			if (ctx->active && !(val & 0x80)) {
+				// stop the running h-blank transfer, the blocks left stay
+				ctx->active = false;
+				break;
+			}
+
+			if (val & 0x80) {
+				ctx->active = true;
+				ctx->blocks = blocks;
+				// already in h-blank (or lcd off), the first block goes now
+				if (ppu_get_mode(gb) == PPU_MODE_HBLANK)
+					hdma_hblank(gb);
+			} else {
+				// general purpose, the cpu waits for the whole copy
+				while (blocks--)
+					hdma_copy_block(gb);
+				ctx->blocks = 0;
+			}
+		}
+		break;
+	}
+}
+
+void hdma_init(gbc_machine *gb) {
+	memset(&gb->hdma, 0, sizeof(gb->hdma));
+	if (!gb->bus.cgb)
+		return;
+
+	for (u16 addr = ADDR_HDMA1; addr <= ADDR_HDMA5; addr++)
+		bus_register_io(gb, addr, hdma_read, hdma_write);
+}
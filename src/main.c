@@ -1,16 +1,121 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gbc.h>
 
+static void usage() {
+    fprintf(stderr,
+        "Usage: gbc [options] <rom filepath>\n"
+        "  --switch-dispatch  use the switch based cpu interpreter\n"
+        "  --trace            print cpu state before every instruction\n"
+        "  --rtc-cycles       run the cartridge clock on emulated time\n"
+        "  --watch SPEC       log accesses to ADDR[-END][:rwx] (default rw)\n"
+        "  --profile PATH     count memory traffic per page and bank, csv to PATH\n"
+        "  --headless         run without a window\n"
+        "  --frames N         headless: stop after N frames\n"
+        "  --cycles N         headless: stop after N cpu cycles\n"
+        "  --dump PATH        headless: write the last frame to PATH (.ppm or raw)\n"
+        "  --dump-every N     headless: also write every Nth frame to PATH_<frame>\n"
+        "  --bench-pixels     time the tile decoding kernels and exit\n"
+        "  --bench-bus        time memory accesses on the rom and exit\n");
+}
+
+static bool parse_u64(const char *arg, u64 *out) {
+    char *end;
+    if (!arg || !*arg)
+        return false;
+    *out = strtoull(arg, &end, 0);
+    return *end == 0;
+}
+
+// ADDR[-END][:rwx], addresses in hex
+static bool parse_watch(const char *arg, watch_range *out) {
+    char *end;
+    if (!arg || !*arg)
+        return false;
+
+    unsigned long start = strtoul(arg, &end, 16);
+    unsigned long last = start;
+    if (*end == '-')
+        last = strtoul(end + 1, &end, 16);
+    if (start > 0xFFFF || last > 0xFFFF || last < start)
+        return false;
+
+    out->start = start;
+    out->end = last;
+    out->kinds = WATCH_READ | WATCH_WRITE;
+    if (*end == ':') {
+        out->kinds = 0;
+        for (end++; *end; end++) {
+            switch (*end) {
+                case 'r': out->kinds |= WATCH_READ; break;
+                case 'w': out->kinds |= WATCH_WRITE; break;
+                case 'x': out->kinds |= WATCH_EXEC; break;
+                default: return false;
+            }
+        }
+    }
+    return *end == 0 && out->kinds;
+}
 
 int main(int argc, const char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: gbc <rom filepath>\n");
+    const char *rom_filepath = NULL;
+    gbc_options options = {0};
+    bool bad_args = false;
+    u64 value;
+
+    for (int i = 1; i < argc && !bad_args; i++) {
+        const char *next = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--switch-dispatch") == 0) {
+            options.switch_dispatch = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            options.trace = true;
+        } else if (strcmp(argv[i], "--rtc-cycles") == 0) {
+            options.rtc_cycles = true;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            bad_args = !next;
+            options.profile_path = next;
+            i++;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            bad_args = options.watch_count == WATCH_MAX || !parse_watch(next, &options.watches[options.watch_count++]);
+            i++;
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            bad_args = !parse_u64(next, &options.frames);
+            i++;
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            bad_args = !parse_u64(next, &options.cycles);
+            i++;
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            bad_args = !next;
+            options.dump_path = next;
+            i++;
+        } else if (strcmp(argv[i], "--dump-every") == 0) {
+            bad_args = !parse_u64(next, &value) || value > UINT32_MAX;
+            options.dump_every = (u32)value;
+            i++;
+        } else if (strcmp(argv[i], "--bench-pixels") == 0) {
+            pixel_benchmark();
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[i], "--bench-bus") == 0) {
+            options.bench_bus = true;
+        } else if (!rom_filepath) {
+            rom_filepath = argv[i];
+        } else {
+            bad_args = true;
+        }
+    }
+
+    if (bad_args || !rom_filepath) {
+        usage();
         return EXIT_FAILURE;
     }
 
-	gbc_run(argv[1]);
+    if (gbc_run(rom_filepath, &options) != 0)
+        return EXIT_FAILURE;
 
-	return EXIT_SUCCESS;
+    return EXIT_SUCCESS;
 }
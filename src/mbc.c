@@ -0,0 +1,467 @@
+#include "mbc.h"
+#include "gbc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "bus.h"
+#include "profile.h"
+#include "rtc.h"
+#include "scheduler.h"
+
+#define ROM_BANK_SIZE 0x4000
+#define RAM_BANK_SIZE 0x2000
+#define MBC2_RAM_SIZE 0x200
+// dirty save pages are flushed at most once a frame
+#define MBC_SAVE_SYNC_CYCLES 17556
+
+typedef void (*mbc_write_handler)(gbc_machine *gb, u16 addr, u8 val);
+
+// cartridge type byte 0x147
+typedef struct {
+	mbc_type type;
+	bool ram;
+	bool battery;
+	bool rtc;
+	bool known;
+} mbc_cart_type;
+
+static const mbc_cart_type mbc_cart_types[0x100] = {
+	[0x00] = { MBC_NONE, false, false, false, true },
+	[0x01] = { MBC_1, false, false, false, true },
+	[0x02] = { MBC_1, true, false, false, true },
+	[0x03] = { MBC_1, true, true, false, true },
+	[0x05] = { MBC_2, true, false, false, true },
+	[0x06] = { MBC_2, true, true, false, true },
+	[0x08] = { MBC_NONE, true, false, false, true },
+	[0x09] = { MBC_NONE, true, true, false, true },
+	[0x0F] = { MBC_3, false, true, true, true },
+	[0x10] = { MBC_3, true, true, true, true },
+	[0x11] = { MBC_3, false, false, false, true },
+	[0x12] = { MBC_3, true, false, false, true },
+	[0x13] = { MBC_3, true, true, false, true },
+	[0x19] = { MBC_5, false, false, false, true },
+	[0x1A] = { MBC_5, true, false, false, true },
+	[0x1B] = { MBC_5, true, true, false, true },
+	[0x1C] = { MBC_5, false, false, false, true },
+	[0x1D] = { MBC_5, true, false, false, true },
+	[0x1E] = { MBC_5, true, true, false, true },
+};
+
+// header ram size byte 0x149 in bytes, 2 KiB carts only use part of a bank
+static u32 mbc_ram_size(u8 ram_size) {
+	switch (ram_size) {
+		case 0x1: return 0x800;
+		case 0x2: return RAM_BANK_SIZE;
+		case 0x3: return 4 * RAM_BANK_SIZE;
+		case 0x4: return 16 * RAM_BANK_SIZE;
+		case 0x5: return 8 * RAM_BANK_SIZE;
+		default: return 0;
+	}
+}
+
+static void mbc_unmap_ram(gbc_machine *gb) {
+	gb->mbc.ram_offset = MBC_RAM_UNMAPPED;
+	bus_map_cart_ram(gb, NULL, NULL);
+}
+
+// repoint 0xA000-0xBFFF, plain ram banks are accessed through the page table,
+// everything else (disabled, mbc2 nibbles, partial banks, rtc registers)
+// through the handlers
+static void mbc_map_ram(gbc_machine *gb, u32 bank) {
+	mbc_context *ctx = &gb->mbc;
+	if (!ctx->ram_enabled || !ctx->ram_banks || ctx->ram_size < RAM_BANK_SIZE) {
+		mbc_unmap_ram(gb);
+		return;
+	}
+
+	u32 offset = (bank % ctx->ram_banks) * RAM_BANK_SIZE;
+	if (offset != ctx->ram_offset)
+		profile_switch(gb, PROFILE_BANK_RAM, offset / RAM_BANK_SIZE);
+	ctx->ram_offset = offset;
+	u8 *ram = ctx->ram + ctx->ram_offset;
+	// save backed pages start write protected to catch the first store
+	bus_map_cart_ram(gb, ram, ctx->save_mapped ? NULL : ram);
+}
+
+static void mbc_save_mark_dirty(gbc_machine *gb, u32 offset) {
+	mbc_context *ctx = &gb->mbc;
+	if (!ctx->save_mapped)
+		return;
+
+	u32 page = offset >> 8;
+	ctx->save_dirty[page / 64] |= 1ull << (page % 64);
+	if (!scheduler_pending(gb, SCHED_SAVE_SYNC))
+		scheduler_schedule(gb, SCHED_SAVE_SYNC, cpu_get_ticks(gb) + MBC_SAVE_SYNC_CYCLES);
+}
+
+#ifndef _WIN32
+static void mbc_save_msync(mbc_context *ctx, u32 start, u32 end) {
+	// msync wants a host page aligned start
+	u32 host_page = sysconf(_SC_PAGESIZE);
+	u32 aligned = start & ~(host_page - 1);
+	msync(ctx->ram + aligned, end - aligned, MS_ASYNC);
+}
+#endif
+
+// start writing dirty pages back without waiting and protect them again
+static void mbc_save_sync(gbc_machine *gb, u64 cycle) {
+	mbc_context *ctx = &gb->mbc;
+#ifndef _WIN32
+	u32 run_start = 0;
+	bool in_run = false;
+	for (u32 page = 0; page <= ctx->ram_size / 0x100; page++) {
+		bool dirty = page < ctx->ram_size / 0x100 && (ctx->save_dirty[page / 64] & (1ull << (page % 64)));
+		if (dirty && !in_run) {
+			run_start = page;
+			in_run = true;
+		} else if (!dirty && in_run) {
+			mbc_save_msync(ctx, run_start << 8, page << 8);
+			in_run = false;
+		}
+	}
+#endif
+	memset(ctx->save_dirty, 0, sizeof(ctx->save_dirty));
+
+	if (ctx->ram_offset != MBC_RAM_UNMAPPED)
+		bus_map_cart_ram(gb, ctx->ram + ctx->ram_offset, NULL);
+}
+
+// <rom path without extension>.sav
+static char *mbc_save_path(const char *rom_filepath) {
+	const char *ext = strrchr(rom_filepath, '.');
+	const char *sep = strrchr(rom_filepath, '/');
+	size_t stem = (ext && (!sep || ext > sep)) ? (size_t)(ext - rom_filepath) : strlen(rom_filepath);
+
+	char *path = malloc(stem + sizeof(".sav"));
+	if (path == NULL)
+		return NULL;
+	memcpy(path, rom_filepath, stem);
+	memcpy(path + stem, ".sav", sizeof(".sav"));
+	return path;
+}
+
+#ifndef _WIN32
+static bool mbc_save_map(mbc_context *ctx) {
+	int fd = open(ctx->save_path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return false;
+
+	// never shrink a save written by something that appends extra data
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (st.st_size < ctx->ram_size && ftruncate(fd, ctx->ram_size) != 0)) {
+		close(fd);
+		return false;
+	}
+
+	void *data = mmap(NULL, ctx->ram_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	ctx->ram = data;
+	ctx->save_mapped = true;
+	return true;
+}
+#endif
+
+// buffered fallback, the whole file is read now and written on exit
+static void mbc_save_load(mbc_context *ctx) {
+	FILE *file = fopen(ctx->save_path, "rb");
+	if (!file)
+		return;
+	fread(ctx->ram, 1, ctx->ram_size, file);
+	fclose(file);
+}
+
+static void mbc_save_store(mbc_context *ctx) {
+	FILE *file = fopen(ctx->save_path, "r+b");
+	if (!file)
+		file = fopen(ctx->save_path, "wb");
+	if (!file) {
+		perror("Failed to write save file.");
+		return;
+	}
+	fwrite(ctx->ram, 1, ctx->ram_size, file);
+	fclose(file);
+}
+
+// the clock state trails the ram in the save file
+static void mbc_rtc_load(gbc_machine *gb) {
+	mbc_context *ctx = &gb->mbc;
+	FILE *file = fopen(ctx->save_path, "rb");
+	if (!file)
+		return;
+
+	u8 data[RTC_SAVE_SIZE];
+	u32 size = 0;
+	if (fseek(file, ctx->ram_size, SEEK_SET) == 0)
+		size = fread(data, 1, sizeof(data), file);
+	fclose(file);
+	rtc_load(gb, data, size);
+}
+
+static void mbc_rtc_store(gbc_machine *gb) {
+	mbc_context *ctx = &gb->mbc;
+	FILE *file = fopen(ctx->save_path, "r+b");
+	if (!file)
+		file = fopen(ctx->save_path, "wb");
+	if (!file) {
+		perror("Failed to write save file.");
+		return;
+	}
+
+	u8 data[RTC_SAVE_SIZE];
+	rtc_save(gb, data);
+	if (fseek(file, ctx->ram_size, SEEK_SET) == 0)
+		fwrite(data, 1, sizeof(data), file);
+	fclose(file);
+}
+
+static void mbc_map_rom(gbc_machine *gb, u16 window, u32 bank) {
+	bus_map_rom_bank(gb, window, bank % gb->mbc.rom_banks);
+}
+
+static void mbc_none_write(gbc_machine *gb, u16 addr, u8 val) {
+}
+
+static void mbc1_update(gbc_machine *gb) {
+	mbc_context *ctx = &gb->mbc;
+	// the upper bits also bank 0x0000-0x3FFF and the ram in mode 1
+	mbc_map_rom(gb, 0x0000, ctx->mode ? ctx->bank_hi << 5 : 0);
+	mbc_map_rom(gb, 0x4000, (ctx->bank_hi << 5) | ctx->rom_bank);
+	mbc_map_ram(gb, ctx->mode ? ctx->bank_hi : 0);
+}
+
+static void mbc1_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_context *ctx = &gb->mbc;
+	switch (addr >> 13) {
+		case 0: // 0x0000-0x1FFF
+			ctx->ram_enabled = (val & 0xF) == 0xA;
+		break;
+		case 1: // 0x2000-0x3FFF
+			ctx->rom_bank = val & 0x1F;
+			if (ctx->rom_bank == 0)
+				ctx->rom_bank = 1;
+		break;
+		case 2: // 0x4000-0x5FFF
+			ctx->bank_hi = val & 0x3;
+		break;
+		case 3: // 0x6000-0x7FFF
+			ctx->mode = val & 0x1;
+		break;
+	}
+	mbc1_update(gb);
+}
+
+static void mbc2_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_context *ctx = &gb->mbc;
+	if (addr >= 0x4000)
+		return;
+
+	// address bit 8 selects between ram enable and rom bank
+	if (addr & 0x100) {
+		ctx->rom_bank = val & 0xF;
+		if (ctx->rom_bank == 0)
+			ctx->rom_bank = 1;
+		mbc_map_rom(gb, 0x4000, ctx->rom_bank);
+	} else {
+		ctx->ram_enabled = (val & 0xF) == 0xA;
+	}
+}
+
+static void mbc3_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_context *ctx = &gb->mbc;
+	switch (addr >> 13) {
+		case 0:
+			ctx->ram_enabled = (val & 0xF) == 0xA;
+		break;
+		case 1:
+			ctx->rom_bank = val & 0x7F;
+			if (ctx->rom_bank == 0)
+				ctx->rom_bank = 1;
+			mbc_map_rom(gb, 0x4000, ctx->rom_bank);
+			return;
+		case 2:
+			// 0x00-0x03 ram bank, 0x08-0x0C rtc register
+			ctx->ram_bank = val & 0xF;
+		break;
+		case 3:
+			if (ctx->has_rtc)
+				rtc_latch(gb, val);
+			return;
+	}
+
+	if (ctx->ram_bank < 0x8)
+		mbc_map_ram(gb, ctx->ram_bank);
+	else
+		mbc_unmap_ram(gb);
+}
+
+static void mbc5_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_context *ctx = &gb->mbc;
+	switch (addr >> 12) {
+		case 0x0:
+		case 0x1:
+			ctx->ram_enabled = (val & 0xF) == 0xA;
+			mbc_map_ram(gb, ctx->ram_bank);
+		break;
+		case 0x2:
+			ctx->rom_bank = (ctx->rom_bank & 0x100) | val;
+			mbc_map_rom(gb, 0x4000, ctx->rom_bank);
+		break;
+		case 0x3:
+			ctx->rom_bank = (ctx->rom_bank & 0xFF) | ((val & 0x1) << 8);
+			mbc_map_rom(gb, 0x4000, ctx->rom_bank);
+		break;
+		case 0x4:
+		case 0x5:
+			ctx->ram_bank = val & 0xF;
+			mbc_map_ram(gb, ctx->ram_bank);
+		break;
+	}
+}
+
+static const mbc_write_handler mbc_mappers[MBC_COUNT] = {
+	[MBC_NONE] = mbc_none_write,
+	[MBC_1] = mbc1_write,
+	[MBC_2] = mbc2_write,
+	[MBC_3] = mbc3_write,
+	[MBC_5] = mbc5_write,
+};
+
+void mbc_init(gbc_machine *gb, const cart_context *cart_ctx) {
+	mbc_context *ctx = &gb->mbc;
+	memset(ctx, 0, sizeof(*ctx));
+
+	const mbc_cart_type *cart_type = &mbc_cart_types[cart_ctx->header->type];
+	if (!cart_type->known)
+		fprintf(stderr, "ERR: unsupported cartridge type %02X, running without a mapper\n", cart_ctx->header->type);
+
+	ctx->type = cart_type->type;
+	ctx->has_ram = cart_type->ram;
+	ctx->has_battery = cart_type->battery;
+	ctx->has_rtc = cart_type->rtc;
+
+	ctx->rom_banks = (cart_ctx->rom_size + ROM_BANK_SIZE - 1) / ROM_BANK_SIZE;
+	if (ctx->rom_banks < 2)
+		ctx->rom_banks = 2;
+
+	if (ctx->type == MBC_2) {
+		ctx->ram_banks = 1;
+		ctx->ram_size = MBC2_RAM_SIZE;
+	} else if (ctx->has_ram) {
+		ctx->ram_size = mbc_ram_size(cart_ctx->header->ram_size);
+		ctx->ram_banks = (ctx->ram_size + RAM_BANK_SIZE - 1) / RAM_BANK_SIZE;
+	}
+	if ((ctx->ram_size || ctx->has_rtc) && ctx->has_battery) {
+		ctx->save_path = mbc_save_path(cart_ctx->filepath);
+#ifndef _WIN32
+		if (ctx->save_path && ctx->ram_size && !mbc_save_map(ctx))
+			fprintf(stderr, "ERR: failed to map save file %s, saving on exit only\n", ctx->save_path);
+#endif
+	}
+	if (ctx->ram_size && !ctx->ram) {
+		ctx->ram = calloc(1, ctx->ram_size);
+		if (ctx->save_path)
+			mbc_save_load(ctx);
+	}
+	scheduler_register(gb, SCHED_SAVE_SYNC, mbc_save_sync);
+	if (ctx->has_rtc) {
+		rtc_init(gb);
+		if (ctx->save_path)
+			mbc_rtc_load(gb);
+	}
+
+	// rom only carts have no enable register
+	ctx->ram_enabled = ctx->type == MBC_NONE;
+	ctx->rom_bank = 1;
+
+	mbc_map_rom(gb, 0x0000, 0);
+	mbc_map_rom(gb, 0x4000, 1);
+	mbc_map_ram(gb, 0);
+}
+
+void mbc_shutdown(gbc_machine *gb) {
+	mbc_context *ctx = &gb->mbc;
+	if (ctx->save_mapped) {
+#ifndef _WIN32
+		msync(ctx->ram, ctx->ram_size, MS_SYNC);
+		munmap(ctx->ram, ctx->ram_size);
+#endif
+	} else {
+		if (ctx->save_path && ctx->ram)
+			mbc_save_store(ctx);
+		free(ctx->ram);
+	}
+	if (ctx->has_rtc && ctx->save_path)
+		mbc_rtc_store(gb);
+
+	free(ctx->save_path);
+	ctx->save_path = NULL;
+	ctx->save_mapped = false;
+	ctx->ram = NULL;
+}
+
+void mbc_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_mappers[gb->mbc.type](gb, addr, val);
+}
+
+u8 mbc_ram_read(gbc_machine *gb, u16 addr) {
+	mbc_context *ctx = &gb->mbc;
+	if (!ctx->ram_enabled)
+		return 0xFF;
+	if (ctx->type == MBC_3 && ctx->ram_bank >= 0x8)
+		return ctx->has_rtc ? rtc_read(gb, ctx->ram_bank) : 0xFF;
+	if (!ctx->ram)
+		return 0xFF;
+
+	if (ctx->type == MBC_2) {
+		// 512 half bytes mirrored through the whole window
+		return ctx->ram[addr & (MBC2_RAM_SIZE - 1)] | 0xF0;
+	}
+	if (ctx->ram_size < RAM_BANK_SIZE) {
+		// a partial bank mirrors through the window
+		return ctx->ram[addr & (ctx->ram_size - 1)];
+	}
+	return 0xFF;
+}
+
+void mbc_ram_write(gbc_machine *gb, u16 addr, u8 val) {
+	mbc_context *ctx = &gb->mbc;
+	if (!ctx->ram_enabled)
+		return;
+	if (ctx->type == MBC_3 && ctx->ram_bank >= 0x8) {
+		if (ctx->has_rtc)
+			rtc_write(gb, ctx->ram_bank, val);
+		return;
+	}
+	if (!ctx->ram)
+		return;
+
+	if (ctx->ram_offset != MBC_RAM_UNMAPPED) {
+		// first store to a write protected save page, later ones are plain
+		u32 offset = ctx->ram_offset + (addr - 0xA000);
+		ctx->ram[offset] = val;
+		mbc_save_mark_dirty(gb, offset);
+		bus_map_write_page(gb, addr, ctx->ram + (offset & ~0xFF));
+		return;
+	}
+
+	if (ctx->type == MBC_2) {
+		u32 offset = addr & (MBC2_RAM_SIZE - 1);
+		ctx->ram[offset] = val & 0xF;
+		mbc_save_mark_dirty(gb, offset);
+	} else if (ctx->ram_size < RAM_BANK_SIZE) {
+		u32 offset = addr & (ctx->ram_size - 1);
+		ctx->ram[offset] = val;
+		mbc_save_mark_dirty(gb, offset);
+	}
+}
@@ -0,0 +1,271 @@
+#include "pixel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_X86 1
+#include <immintrin.h>
+#endif
+
+static inline u8 pixel_shade_of(u8 palette, u8 color) {
+	return (palette >> (color * 2)) & 3;
+}
+
+static void pixel_decode_scalar(const u8 *data, u32 rows, u8 palette, u8 *out, u8 *flipped) {
+	for (u32 r = 0; r < rows; r++, data += 2) {
+		u8 lo = data[0], hi = data[1];
+		for (int i = 0; i < 8; i++) {
+			u8 shade = pixel_shade_of(palette, ((lo >> (7 - i)) & 1) | (((hi >> (7 - i)) & 1) << 1));
+			if (out)
+				out[r * 8 + i] = shade;
+			if (flipped)
+				flipped[r * 8 + 7 - i] = shade;
+		}
+	}
+}
+
+static void pixel_shade_scalar(const u8 *in, u8 *out, u32 count, u8 palette) {
+	u8 lut[4] = { pixel_shade_of(palette, 0), pixel_shade_of(palette, 1), pixel_shade_of(palette, 2), pixel_shade_of(palette, 3) };
+	for (u32 i = 0; i < count; i++)
+		out[i] = lut[in[i] & 3];
+}
+
+static const pixel_kernels pixel_scalar = { "scalar", pixel_decode_scalar, pixel_shade_scalar };
+
+#ifdef PIXEL_X86
+#define PIXEL_BYTES 0x0101010101010101ull
+
+// pdep drops bit n of each plane into byte n, which is pixel 7 - n: the
+// flipped row as is and the normal one byte swapped
+__attribute__((target("bmi2")))
+static void pixel_decode_bmi2(const u8 *data, u32 rows, u8 palette, u8 *out, u8 *flipped) {
+	u8 lut[4] = { pixel_shade_of(palette, 0), pixel_shade_of(palette, 1), pixel_shade_of(palette, 2), pixel_shade_of(palette, 3) };
+	for (u32 r = 0; r < rows; r++, data += 2) {
+		u64 row = _pdep_u64(data[0], PIXEL_BYTES) | _pdep_u64(data[1], PIXEL_BYTES << 1);
+		if (palette != PIXEL_PALETTE_IDENTITY) {
+			u8 bytes[8];
+			memcpy(bytes, &row, 8);
+			for (int i = 0; i < 8; i++)
+				bytes[i] = lut[bytes[i]];
+			memcpy(&row, bytes, 8);
+		}
+		if (flipped)
+			memcpy(flipped + r * 8, &row, 8);
+		if (out) {
+			row = __builtin_bswap64(row);
+			memcpy(out + r * 8, &row, 8);
+		}
+	}
+}
+
+// color indices (0-3) in each byte of idx through the palette, sse2 has no
+// byte shuffle so every index is compared
+__attribute__((target("sse2")))
+static inline __m128i pixel_shade_sse2_vec(__m128i idx, u8 palette) {
+	__m128i shades = _mm_setzero_si128();
+	for (int c = 1; c < 4; c++) {
+		__m128i hit = _mm_cmpeq_epi8(idx, _mm_set1_epi8(c));
+		shades = _mm_or_si128(shades, _mm_and_si128(hit, _mm_set1_epi8(pixel_shade_of(palette, c))));
+	}
+	__m128i zero = _mm_cmpeq_epi8(idx, _mm_setzero_si128());
+	return _mm_or_si128(shades, _mm_and_si128(zero, _mm_set1_epi8(pixel_shade_of(palette, 0))));
+}
+
+// two rows per register, each plane byte is spread over its row's 8 bytes
+// by unpacking against itself and tested against one bit per byte
+__attribute__((target("sse2")))
+static inline __m128i pixel_decode_sse2_vec(__m128i spread_lo, __m128i spread_hi, __m128i bits) {
+	__m128i b0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(spread_lo, bits), bits), _mm_set1_epi8(1));
+	__m128i b1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(spread_hi, bits), bits), _mm_set1_epi8(2));
+	return _mm_or_si128(b0, b1);
+}
+
+__attribute__((target("sse2")))
+static void pixel_decode_sse2(const u8 *data, u32 rows, u8 palette, u8 *out, u8 *flipped) {
+	const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 1, 2, 4, 8, 16, 32, 64, (char)128);
+	const __m128i bits_flipped = _mm_set_epi8((char)128, 64, 32, 16, 8, 4, 2, 1, (char)128, 64, 32, 16, 8, 4, 2, 1);
+	for (u32 r = 0; r < rows; r += 2, data += 4) {
+		// an odd last row decodes against a zero second row and only stores half
+		bool pair = rows - r > 1;
+		u32 planes = pair ? (u32)data[0] | data[1] << 8 | data[2] << 16 | (u32)data[3] << 24 : (u32)data[0] | data[1] << 8;
+		// lo0 hi0 lo1 hi1 -> lo0 x8 hi0 x8 and lo1 x8 hi1 x8
+		__m128i v = _mm_cvtsi32_si128((int)planes);
+		v = _mm_unpacklo_epi8(v, v);
+		v = _mm_unpacklo_epi16(v, v);
+		__m128i row0 = _mm_unpacklo_epi32(v, v), row1 = _mm_unpackhi_epi32(v, v);
+		__m128i lo = _mm_unpacklo_epi64(row0, row1), hi = _mm_unpackhi_epi64(row0, row1);
+		if (out) {
+			__m128i p = pixel_decode_sse2_vec(lo, hi, bits);
+			if (palette != PIXEL_PALETTE_IDENTITY)
+				p = pixel_shade_sse2_vec(p, palette);
+			if (pair)
+				_mm_storeu_si128((__m128i *)(out + r * 8), p);
+			else
+				_mm_storel_epi64((__m128i *)(out + r * 8), p);
+		}
+		if (flipped) {
+			__m128i p = pixel_decode_sse2_vec(lo, hi, bits_flipped);
+			if (palette != PIXEL_PALETTE_IDENTITY)
+				p = pixel_shade_sse2_vec(p, palette);
+			if (pair)
+				_mm_storeu_si128((__m128i *)(flipped + r * 8), p);
+			else
+				_mm_storel_epi64((__m128i *)(flipped + r * 8), p);
+		}
+	}
+}
+
+__attribute__((target("sse2")))
+static void pixel_shade_sse2(const u8 *in, u8 *out, u32 count, u8 palette) {
+	u32 i = 0;
+	for (; i + 16 <= count; i += 16)
+		_mm_storeu_si128((__m128i *)(out + i), pixel_shade_sse2_vec(_mm_loadu_si128((const __m128i *)(in + i)), palette));
+	pixel_shade_scalar(in + i, out + i, count - i, palette);
+}
+
+// four rows per register, the planes are spread with a byte shuffle and the
+// palette is another one
+__attribute__((target("avx2")))
+static inline __m256i pixel_decode_avx2_vec(__m256i lo, __m256i hi, __m256i bits, __m256i lut) {
+	__m256i b0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), _mm256_set1_epi8(1));
+	__m256i b1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), _mm256_set1_epi8(2));
+	return _mm256_shuffle_epi8(lut, _mm256_or_si256(b0, b1));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i pixel_lut_avx2(u8 palette) {
+	return _mm256_broadcastsi128_si256(_mm_setr_epi8(
+		pixel_shade_of(palette, 0), pixel_shade_of(palette, 1), pixel_shade_of(palette, 2), pixel_shade_of(palette, 3),
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+}
+
+// groups of four rows in avx2, the remainder one row at a time with pdep
+__attribute__((target("avx2,bmi2")))
+static void pixel_decode_avx2(const u8 *data, u32 rows, u8 palette, u8 *out, u8 *flipped) {
+	u32 r = 0;
+	if (rows >= 4) {
+		const __m256i bits = _mm256_set1_epi64x(0x0102040810204080ull);
+		const __m256i bits_flipped = _mm256_set1_epi64x(0x8040201008040201ull);
+		const __m256i spread_lo = _mm256_setr_epi64x(0, 0x0202020202020202ull, 0x0404040404040404ull, 0x0606060606060606ull);
+		const __m256i spread_hi = _mm256_add_epi8(spread_lo, _mm256_set1_epi8(1));
+		const __m256i lut = pixel_lut_avx2(palette);
+		for (; r + 4 <= rows; r += 4, data += 8) {
+			u64 planes;
+			memcpy(&planes, data, 8);
+			__m256i v = _mm256_set1_epi64x((long long)planes);
+			__m256i lo = _mm256_shuffle_epi8(v, spread_lo), hi = _mm256_shuffle_epi8(v, spread_hi);
+			if (out)
+				_mm256_storeu_si256((__m256i *)(out + r * 8), pixel_decode_avx2_vec(lo, hi, bits, lut));
+			if (flipped)
+				_mm256_storeu_si256((__m256i *)(flipped + r * 8), pixel_decode_avx2_vec(lo, hi, bits_flipped, lut));
+		}
+	}
+	if (r < rows)
+		pixel_decode_bmi2(data, rows - r, palette, out ? out + r * 8 : NULL, flipped ? flipped + r * 8 : NULL);
+}
+
+__attribute__((target("avx2")))
+static void pixel_shade_avx2(const u8 *in, u8 *out, u32 count, u8 palette) {
+	const __m256i lut = pixel_lut_avx2(palette);
+	u32 i = 0;
+	for (; i + 32 <= count; i += 32) {
+		__m256i idx = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(in + i)), _mm256_set1_epi8(3));
+		_mm256_storeu_si256((__m256i *)(out + i), _mm256_shuffle_epi8(lut, idx));
+	}
+	pixel_shade_sse2(in + i, out + i, count - i, palette);
+}
+
+static const pixel_kernels pixel_sse2 = { "sse2", pixel_decode_sse2, pixel_shade_sse2 };
+static const pixel_kernels pixel_bmi2 = { "bmi2", pixel_decode_bmi2, pixel_shade_sse2 };
+static const pixel_kernels pixel_avx2 = { "avx2", pixel_decode_avx2, pixel_shade_avx2 };
+#endif
+
+// supported sets, best first
+static u32 pixel_supported(const pixel_kernels **sets) {
+	u32 count = 0;
+#ifdef PIXEL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+		sets[count++] = &pixel_avx2;
+	if (__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("sse2"))
+		sets[count++] = &pixel_bmi2;
+	if (__builtin_cpu_supports("sse2"))
+		sets[count++] = &pixel_sse2;
+#endif
+	sets[count++] = &pixel_scalar;
+	return count;
+}
+
+const pixel_kernels *pixel_get_kernels(void) {
+	// cpu features don't change, every machine shares the choice
+	static const pixel_kernels *selected;
+	if (selected)
+		return selected;
+
+	const pixel_kernels *sets[4];
+	u32 count = pixel_supported(sets);
+	const char *forced = getenv("GBC_PIXEL_KERNELS");
+	const pixel_kernels *choice = sets[0];
+	for (u32 i = 0; forced && i < count; i++) {
+		if (strcmp(sets[i]->name, forced) == 0)
+			choice = sets[i];
+	}
+	selected = choice;
+	return selected;
+}
+
+static double pixel_seconds(void) {
+	return (double)clock() / CLOCKS_PER_SEC;
+}
+
+void pixel_benchmark(void) {
+	// a full vram bank of tile data, and a scanline's worth of indices
+	enum { ROWS = 384 * 8, LINE = 160, ITERATIONS = 2000 };
+	static u8 data[ROWS * 2], ref[ROWS * 8], ref_flipped[ROWS * 8], out[ROWS * 8], flipped[ROWS * 8];
+	u8 line[LINE], line_ref[LINE], line_out[LINE];
+	u32 seed = 1;
+	for (u32 i = 0; i < sizeof(data); i++)
+		data[i] = (seed = seed * 1103515245 + 12345) >> 16;
+	for (u32 i = 0; i < LINE; i++)
+		line[i] = data[i] & 3;
+
+	const u8 palette = 0x1B;
+	pixel_scalar.decode(data, ROWS - 3, palette, ref, ref_flipped);
+	pixel_scalar.shade(line, line_ref, LINE, palette);
+
+	const pixel_kernels *sets[4];
+	u32 count = pixel_supported(sets);
+	printf("%-8s %12s %12s %12s %s\n", "kernels", "row ns", "bank us", "line ns", "");
+	for (u32 s = 0; s < count; s++) {
+		const pixel_kernels *k = sets[s];
+		memset(out, 0, sizeof(out));
+		memset(flipped, 0, sizeof(flipped));
+		// odd row count so every kernel also runs its tail
+		k->decode(data, ROWS - 3, palette, out, flipped);
+		k->shade(line, line_out, LINE, palette);
+		bool ok = !memcmp(out, ref, sizeof(ref)) && !memcmp(flipped, ref_flipped, sizeof(ref_flipped)) && !memcmp(line_out, line_ref, LINE);
+
+		// single rows as written by the cpu, identity palette like the tile cache
+		double start = pixel_seconds();
+		for (u32 it = 0; it < ITERATIONS; it++) {
+			for (u32 r = 0; r < ROWS; r++)
+				k->decode(data + r * 2, 1, PIXEL_PALETTE_IDENTITY, out + r * 8, flipped + r * 8);
+		}
+		double row_ns = (pixel_seconds() - start) * 1e9 / ((double)ITERATIONS * ROWS);
+
+		start = pixel_seconds();
+		for (u32 it = 0; it < ITERATIONS; it++)
+			k->decode(data, ROWS, PIXEL_PALETTE_IDENTITY, out, flipped);
+		double bank_us = (pixel_seconds() - start) * 1e6 / ITERATIONS;
+
+		start = pixel_seconds();
+		for (u32 it = 0; it < ITERATIONS * 100; it++)
+			k->shade(line, line_out, LINE, palette + it);
+		double line_ns = (pixel_seconds() - start) * 1e9 / (ITERATIONS * 100.0);
+
+		printf("%-8s %12.2f %12.2f %12.2f %s\n", k->name, row_ns, bank_us, line_ns, ok ? "ok" : "MISMATCH");
+	}
+}
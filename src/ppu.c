@@ -1,51 +1,410 @@
 #include "ppu.h"
+#include "gbc.h"
 #include "common.h"
 #include "bus.h"
+#include "cpu.h"
+#include "hdma.h"
+#include "interrupt.h"
 #include "gui.h"
+#include "scheduler.h"
+#include "tiles.h"
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define OAM_SIZE 0xA0
+#define OAM_DMA_DELAY 2
 
-typedef struct {
-    u8 dma_delay;
-	u16 oam_src;
-	u8 oam_pos;
-} ppu_context;
+// timings in cpu cycles
+#define PPU_OAM_CYCLES 20
+#define PPU_DRAW_CYCLES 43
+#define PPU_LINE_CYCLES 114
+#define PPU_LINES 154
+#define PPU_VBLANK_LINE 144
+#define PPU_FRAME_CYCLES (PPU_LINE_CYCLES * PPU_LINES)
 
-static ppu_context ctx;
+#define LCDC_BG_ENABLE 0x01
+#define LCDC_OBJ_ENABLE 0x02
+#define LCDC_OBJ_TALL 0x04
+#define LCDC_BG_MAP 0x08
+#define LCDC_TILE_DATA 0x10
+#define LCDC_WINDOW_ENABLE 0x20
+#define LCDC_WINDOW_MAP 0x40
+#define LCDC_LCD_ENABLE 0x80
 
-void ppu_init() {
-    memset(&ctx, 0, sizeof(ctx));
-}
+#define STAT_LYC_EQUAL 0x04
+#define STAT_HBLANK_INT 0x08
+#define STAT_VBLANK_INT 0x10
+#define STAT_OAM_INT 0x20
+#define STAT_LYC_INT 0x40
+#define STAT_INT_MASK 0x78
+
+#define OAM_FLAG_BEHIND_BG 0x80
+#define OAM_FLAG_Y_FLIP 0x40
+#define OAM_FLAG_X_FLIP 0x20
+#define OAM_FLAG_PALETTE 0x10
+
+#define PPU_LINE_OBJS 10
+// vram offsets of the tile maps, tile cache index of tile 0 at 0x9000
+#define PPU_MAP_LOW 0x1800
+#define PPU_MAP_HIGH 0x1C00
+#define PPU_TILE_SIGNED_INDEX 256
+
+
+//const u32 ppu_shade_colors[4] = {0xFFFFFFFF, 0xFFAAAAAA, 0xFF555555, 0xFF000000}; // black + white
+const u32 ppu_shade_colors[4] = { 0xFF9BBC0F, 0xFF8BAC0F, 0xFF306230, 0xFF0F380F }; // greenish
 
-void ppu_dma_start(u8 addr) {
-    // given addr is expected to be two highest bits for address
-	ctx.oam_pos = 0;
-	ctx.oam_src = addr * 0x100;
-    ctx.dma_delay = 2;
+// tile cache index of a background tile number, 0x8800 addressing is signed
+// around the tile at 0x9000
+static inline u32 ppu_bg_tile(u8 lcdc, u8 tile) {
+    return (lcdc & LCDC_TILE_DATA) ? tile : PPU_TILE_SIGNED_INDEX + (i8)tile;
 }
 
-bool ppu_dma_is_transferring() {
-    return ctx.oam_pos < OAM_SIZE;
+// background or window indices for tiles map entries starting at map column
+// col, copied row by row out of the decoded tile cache
+static void ppu_render_map_row(gbc_machine *gb, u8 lcdc, u16 map, u8 y, u8 col, int tiles, u8 *out) {
+    const u8 *map_row = gb->bus.vram + map + (y / 8) * 32;
+    for (int i = 0; i < tiles; i++, out += 8)
+        memcpy(out, tiles_row(&gb->tiles, ppu_bg_tile(lcdc, map_row[(col + i) & 31]), y & 7, false), 8);
 }
 
-void ppu_tick() {
-    if (ctx.oam_src) {
-        // wait until delay
-        if (ctx.dma_delay) {
-            ctx.dma_delay--;
-            return;
+static void ppu_render_objs(gbc_machine *gb, u8 ly, u8 lcdc, const u8 *bg, u8 *line) {
+    const oam_entry *oam = (const oam_entry *)bus_oam(gb);
+    u8 height = (lcdc & LCDC_OBJ_TALL) ? 16 : 8;
+    u8 obp[2] = { bus_io_read_mem(gb, ADDR_OBP0), bus_io_read_mem(gb, ADDR_OBP1) };
+
+    // the first 10 objects on the line in oam order, then ordered by x
+    // (oam order on ties), the first one drawn to a pixel wins
+    const oam_entry *objs[PPU_LINE_OBJS];
+    int count = 0;
+    for (int i = 0; i < 40 && count < PPU_LINE_OBJS; i++) {
+        int row = ly + 16 - oam[i].y;
+        if (row >= 0 && row < height)
+            objs[count++] = &oam[i];
+    }
+    for (int i = 1; i < count; i++) {
+        const oam_entry *obj = objs[i];
+        int j = i;
+        for (; j > 0 && objs[j - 1]->x > obj->x; j--)
+            objs[j] = objs[j - 1];
+        objs[j] = obj;
+    }
+
+    bool taken[PPU_SCREEN_WIDTH + 8] = {0};
+    for (int i = 0; i < count; i++) {
+        const oam_entry *obj = objs[i];
+        u8 row = ly + 16 - obj->y;
+        if (obj->flags & OAM_FLAG_Y_FLIP)
+            row = height - 1 - row;
+        u8 tile = height == 16 ? obj->tile_idx & 0xFE : obj->tile_idx;
+
+        // the lower half of a tall object is the next tile
+        const u8 *pixels = tiles_row(&gb->tiles, tile + row / 8, row & 7, obj->flags & OAM_FLAG_X_FLIP);
+        u8 palette = obp[!!(obj->flags & OAM_FLAG_PALETTE)];
+
+        for (int p = 0; p < 8; p++) {
+            int x = obj->x - 8 + p;
+            u8 color = pixels[p];
+            if (x < 0 || x >= PPU_SCREEN_WIDTH || !color || taken[x])
+                continue;
+            // an opaque pixel hides lower priority objects even behind the bg
+            taken[x] = true;
+            if ((obj->flags & OAM_FLAG_BEHIND_BG) && bg[x])
+                continue;
+            line[x] = (palette >> (color * 2)) & 3;
         }
+    }
+}
+
+// compose one line into the framebuffer as shades, at the start of its h-blank
+static void ppu_render_line(gbc_machine *gb, u8 ly) {
+    ppu_context *ctx = &gb->ppu;
+    u8 lcdc = bus_io_read_mem(gb, ADDR_LCDC);
+    u8 *line = ctx->framebuffer + ly * PPU_SCREEN_WIDTH;
+    // color indices before the palette, objects check them for priority;
+    // room for a partial tile at each end
+    u8 bg[PPU_SCREEN_WIDTH + 16];
 
-        // copy tile data into OAM space
-        u8 t = bus_read(ctx.oam_src + ctx.oam_pos);
-        bus_write(ADDR_OAM + ctx.oam_pos, t);
-        if (++ctx.oam_pos >= OAM_SIZE) {
-            ctx.oam_src = 0;
-            ctx.oam_pos = 0;
+    if (ly == 0)
+        ctx->window_line = 0;
+
+    if (lcdc & LCDC_BG_ENABLE) {
+        u8 scx = bus_io_read_mem(gb, ADDR_SCX);
+        u8 y = ly + bus_io_read_mem(gb, ADDR_SCY);
+        ppu_render_map_row(gb, lcdc, (lcdc & LCDC_BG_MAP) ? PPU_MAP_HIGH : PPU_MAP_LOW, y, scx / 8, PPU_SCREEN_WIDTH / 8 + 1, bg);
+        memmove(bg, bg + (scx & 7), PPU_SCREEN_WIDTH);
+
+        int wx = bus_io_read_mem(gb, ADDR_WX) - 7;
+        if ((lcdc & LCDC_WINDOW_ENABLE) && ly >= bus_io_read_mem(gb, ADDR_WY) && wx < PPU_SCREEN_WIDTH) {
+            // the window always starts at its first column, pixels left of
+            // the screen edge are dropped
+            u8 win[PPU_SCREEN_WIDTH + 8];
+            int start = wx < 0 ? 0 : wx;
+            ppu_render_map_row(gb, lcdc, (lcdc & LCDC_WINDOW_MAP) ? PPU_MAP_HIGH : PPU_MAP_LOW, ctx->window_line++, 0, (PPU_SCREEN_WIDTH - wx + 7) / 8, win);
+            memcpy(bg + start, win + (start - wx), PPU_SCREEN_WIDTH - start);
         }
+    } else {
+        memset(bg, 0, PPU_SCREEN_WIDTH);
+    }
+
+    u8 bgp = bus_io_read_mem(gb, ADDR_BGP);
+    gb->tiles.kernels->shade(bg, line, PPU_SCREEN_WIDTH, bgp);
+
+    if (lcdc & LCDC_OBJ_ENABLE)
+        ppu_render_objs(gb, ly, lcdc, bg, line);
+}
+
+// the stat interrupt fires on a rising edge of the or of its enabled
+// sources, a source that stays set blocks the others
+static void ppu_update_stat(gbc_machine *gb) {
+    ppu_context *ctx = &gb->ppu;
+    u8 stat = bus_io_read_mem(gb, ADDR_STAT);
+    bool line = false;
+    if (ctx->lcd_on) {
+        line = ((stat & STAT_LYC_INT) && ctx->ly == bus_io_read_mem(gb, ADDR_LYC))
+            || ((stat & STAT_HBLANK_INT) && ctx->mode == PPU_MODE_HBLANK)
+            || ((stat & STAT_VBLANK_INT) && ctx->mode == PPU_MODE_VBLANK)
+            || ((stat & STAT_OAM_INT) && ctx->mode == PPU_MODE_OAM);
+    }
+    if (line && !ctx->stat_line)
+        cpu_request_interrupt(gb, INTERRUPT_LCD_STAT);
+    ctx->stat_line = line;
+}
+
+static void ppu_enter_mode(gbc_machine *gb, ppu_mode mode, u64 cycle) {
+    ppu_context *ctx = &gb->ppu;
+    ctx->mode = mode;
+
+    switch (mode) {
+        case PPU_MODE_OAM:
+            if (ctx->ly == 0) {
+                ctx->frame_start = cycle;
+                ctx->rendered_lines = 0;
+            }
+            scheduler_schedule(gb, SCHED_PPU_MODE, cycle + PPU_OAM_CYCLES);
+        break;
+        case PPU_MODE_DRAW:
+            scheduler_schedule(gb, SCHED_PPU_MODE, cycle + PPU_DRAW_CYCLES);
+        break;
+        case PPU_MODE_HBLANK:
+            scheduler_schedule(gb, SCHED_PPU_MODE, cycle + PPU_LINE_CYCLES - PPU_OAM_CYCLES - PPU_DRAW_CYCLES);
+            // the line itself is rendered lazily, hdma writes catch it up
+            hdma_hblank(gb);
+        break;
+        case PPU_MODE_VBLANK:
+            scheduler_schedule(gb, SCHED_PPU_MODE, cycle + PPU_LINE_CYCLES);
+            if (ctx->ly == PPU_VBLANK_LINE) {
+                ppu_catch_up(gb);
+                ctx->frames++;
+                cpu_request_interrupt(gb, INTERRUPT_VBLANK);
+            }
+        break;
+    }
+    ppu_update_stat(gb);
+}
+
+static void ppu_mode_event(gbc_machine *gb, u64 cycle) {
+    ppu_context *ctx = &gb->ppu;
+    switch (ctx->mode) {
+        case PPU_MODE_OAM:
+            ppu_enter_mode(gb, PPU_MODE_DRAW, cycle);
+        break;
+        case PPU_MODE_DRAW:
+            ppu_enter_mode(gb, PPU_MODE_HBLANK, cycle);
+        break;
+        case PPU_MODE_HBLANK:
+            ctx->ly++;
+            ppu_enter_mode(gb, ctx->ly == PPU_VBLANK_LINE ? PPU_MODE_VBLANK : PPU_MODE_OAM, cycle);
+        break;
+        case PPU_MODE_VBLANK:
+            if (++ctx->ly == PPU_LINES) {
+                ctx->ly = 0;
+                ppu_enter_mode(gb, PPU_MODE_OAM, cycle);
+            } else {
+                ppu_enter_mode(gb, PPU_MODE_VBLANK, cycle);
+            }
+        break;
+    }
+}
+
+static void ppu_frame_event(gbc_machine *gb, u64 cycle) {
+    ppu_context *ctx = &gb->ppu;
+    // only runs with the lcd off, so the host still sees frame boundaries
+    // while the ppu itself is idle
+    ctx->frames++;
+    scheduler_schedule(gb, SCHED_FRAME_END, cycle + PPU_FRAME_CYCLES);
+}
+
+static void ppu_dma_event(gbc_machine *gb, u64 cycle) {
+    ppu_context *ctx = &gb->ppu;
+    // the whole transfer lands at once when it completes, the cpu could
+    // not look at oam (or anything but hram) while it was running
+    bus_set_trap(gb, 0x0000, 0xFEFF, BUS_TRAP_DMA, false);
+    ppu_catch_up(gb);
+    u8 *oam = bus_oam(gb);
+    // the source page is resolved now, so vram/wram bank switches made
+    // during the transfer are seen
+    const u8 *src_page = bus_read_page(gb, ctx->oam_src);
+    if (src_page) {
+        memcpy(oam, src_page, OAM_SIZE);
+    } else {
+        for (u16 i = 0; i < OAM_SIZE; i++)
+            oam[i] = bus_read(gb, ctx->oam_src + i);
+    }
+    ctx->oam_src = 0;
+}
+
+static void ppu_write_lcdc(gbc_machine *gb, u16 addr, u8 val) {
+    ppu_catch_up(gb);
+    bus_io_write_mem(gb, addr, val);
+    ppu_lcdc_write(gb, val);
+}
+
+// position in the frame, events can lag the cpu by part of an instruction
+// so ly and the mode come from the cycle count rather than the event state
+static u64 ppu_frame_position(gbc_machine *gb) {
+    ppu_context *ctx = &gb->ppu;
+    u64 now = cpu_get_ticks(gb);
+    return now > ctx->frame_start ? (now - ctx->frame_start) % PPU_FRAME_CYCLES : 0;
+}
+
+static u8 ppu_read_stat(gbc_machine *gb, u16 addr) {
+    ppu_context *ctx = &gb->ppu;
+    u8 stat = (bus_io_read_mem(gb, addr) & STAT_INT_MASK) | 0x80;
+    if (!ctx->lcd_on)
+        return stat;
+
+    u64 pos = ppu_frame_position(gb);
+    u8 ly = pos / PPU_LINE_CYCLES;
+    u32 dot = pos % PPU_LINE_CYCLES;
+    ppu_mode mode = PPU_MODE_HBLANK;
+    if (ly >= PPU_VBLANK_LINE)
+        mode = PPU_MODE_VBLANK;
+    else if (dot < PPU_OAM_CYCLES)
+        mode = PPU_MODE_OAM;
+    else if (dot < PPU_OAM_CYCLES + PPU_DRAW_CYCLES)
+        mode = PPU_MODE_DRAW;
+    if (ly == bus_io_read_mem(gb, ADDR_LYC))
+        stat |= STAT_LYC_EQUAL;
+    return stat | mode;
+}
+
+static void ppu_write_stat(gbc_machine *gb, u16 addr, u8 val) {
+    bus_io_write_mem(gb, addr, val & STAT_INT_MASK);
+    ppu_update_stat(gb);
+}
+
+static u8 ppu_read_ly(gbc_machine *gb, u16 addr) {
+    ppu_context *ctx = &gb->ppu;
+    return ctx->lcd_on ? ppu_frame_position(gb) / PPU_LINE_CYCLES : 0;
+}
+
+static void ppu_write_lyc(gbc_machine *gb, u16 addr, u8 val) {
+    bus_io_write_mem(gb, addr, val);
+    ppu_update_stat(gb);
+}
+
+// scroll, window position and palettes only affect lines not yet rendered
+static void ppu_write_render_reg(gbc_machine *gb, u16 addr, u8 val) {
+    ppu_catch_up(gb);
+    bus_io_write_mem(gb, addr, val);
+}
+
+static void ppu_write_dma(gbc_machine *gb, u16 addr, u8 val) {
+    ppu_dma_start(gb, val);
+}
+
+void ppu_init(gbc_machine *gb) {
+    memset(&gb->ppu, 0, sizeof(gb->ppu));
+    scheduler_register(gb, SCHED_PPU_MODE, ppu_mode_event);
+    scheduler_register(gb, SCHED_OAM_DMA, ppu_dma_event);
+    scheduler_register(gb, SCHED_FRAME_END, ppu_frame_event);
+    bus_register_io(gb, ADDR_LCDC, NULL, ppu_write_lcdc);
+    bus_register_io(gb, ADDR_STAT, ppu_read_stat, ppu_write_stat);
+    bus_register_io(gb, ADDR_LY, ppu_read_ly, NULL);
+    bus_register_io(gb, ADDR_LYC, NULL, ppu_write_lyc);
+    bus_register_io(gb, ADDR_DMA_TRANSFER, NULL, ppu_write_dma);
+    bus_register_io(gb, ADDR_SCY, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_SCX, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_BGP, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_OBP0, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_OBP1, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_WY, NULL, ppu_write_render_reg);
+    bus_register_io(gb, ADDR_WX, NULL, ppu_write_render_reg);
+    bus_set_trap(gb, 0x8000, 0x9FFF, BUS_TRAP_PPU, true);
+    bus_set_trap(gb, 0xFE00, 0xFEFF, BUS_TRAP_PPU, true);
+
+    // flipped so the write below always starts the matching timeline
+    u8 lcdc = bus_read(gb, ADDR_LCDC);
+    gb->ppu.lcd_on = !(lcdc & LCDC_LCD_ENABLE);
+    ppu_lcdc_write(gb, lcdc);
+}
+
+void ppu_lcdc_write(gbc_machine *gb, u8 val) {
+    ppu_context *ctx = &gb->ppu;
+    bool lcd_on = val & LCDC_LCD_ENABLE;
+    if (lcd_on == ctx->lcd_on)
+        return;
+
+    ctx->lcd_on = lcd_on;
+    ctx->ly = 0;
+    ctx->stat_line = false;
+    if (lcd_on) {
+        scheduler_cancel(gb, SCHED_FRAME_END);
+        ppu_enter_mode(gb, PPU_MODE_OAM, cpu_get_ticks(gb));
+    } else {
+        // nothing to time until the lcd is switched back on, ly reads 0,
+        // stat mode 0 and the screen shows blank
+        ctx->mode = PPU_MODE_HBLANK;
+        memset(ctx->framebuffer, 0, sizeof(ctx->framebuffer));
+        scheduler_cancel(gb, SCHED_PPU_MODE);
+        scheduler_schedule(gb, SCHED_FRAME_END, cpu_get_ticks(gb) + PPU_FRAME_CYCLES);
     }
 }
+
+void ppu_dma_start(gbc_machine *gb, u8 addr) {
+    ppu_context *ctx = &gb->ppu;
+    // given addr is the source page, 0xE0-0xFF read the echo of wram
+    if (addr >= 0xE0)
+        addr -= 0x20;
+    ctx->oam_src = addr * 0x100;
+    bus_set_trap(gb, 0x0000, 0xFEFF, BUS_TRAP_DMA, true);
+    scheduler_schedule(gb, SCHED_OAM_DMA, cpu_get_ticks(gb) + OAM_DMA_DELAY + OAM_SIZE);
+}
+
+bool ppu_dma_is_transferring(gbc_machine *gb) {
+    return scheduler_pending(gb, SCHED_OAM_DMA);
+}
+
+ppu_mode ppu_get_mode(gbc_machine *gb) {
+    return gb->ppu.mode;
+}
+
+u64 ppu_get_frame_count(gbc_machine *gb) {
+    ppu_context *ctx = &gb->ppu;
+    return ctx->frames;
+}
+
+void ppu_catch_up(gbc_machine *gb) {
+    ppu_context *ctx = &gb->ppu;
+    if (!ctx->lcd_on)
+        return;
+
+    // a line is final once its h-blank begins, by then the cpu can no
+    // longer change what it shows
+    u64 now = cpu_get_ticks(gb);
+    u64 drawn = PPU_OAM_CYCLES + PPU_DRAW_CYCLES;
+    u64 pos = now > ctx->frame_start ? now - ctx->frame_start : 0;
+    u64 due = pos < drawn ? 0 : (pos - drawn) / PPU_LINE_CYCLES + 1;
+    if (due > PPU_SCREEN_HEIGHT)
+        due = PPU_SCREEN_HEIGHT;
+    while (ctx->rendered_lines < due)
+        ppu_render_line(gb, ctx->rendered_lines++);
+}
+
+const u8 *ppu_get_framebuffer(gbc_machine *gb) {
+    ppu_context *ctx = &gb->ppu;
+    ppu_catch_up(gb);
+    return ctx->framebuffer;
+}
@@ -0,0 +1,109 @@
+#include "profile.h"
+#include "gbc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bus.h"
+#include "cpu.h"
+#include "mbc.h"
+
+#define PROFILE_RAM_BANK_SIZE 0x2000
+
+static u64 *profile_bank_counters(gbc_machine *gb, profile_bank bank, u32 index) {
+	profile_context *ctx = &gb->profile;
+	switch (bank) {
+		case PROFILE_BANK_ROM:
+			return index < PROFILE_ROM_BANKS ? ctx->rom_banks[index] : NULL;
+		case PROFILE_BANK_RAM:
+			return index < PROFILE_RAM_BANKS ? ctx->ram_banks[index] : NULL;
+		case PROFILE_BANK_WRAM:
+			return index < PROFILE_WRAM_BANKS ? ctx->wram_banks[index] : NULL;
+		case PROFILE_BANK_VRAM:
+			return index < PROFILE_VRAM_BANKS ? ctx->vram_banks[index] : NULL;
+	}
+	return NULL;
+}
+
+// counters of the bank currently mapped at addr, NULL outside banked memory
+static u64 *profile_addr_bank(gbc_machine *gb, u16 addr) {
+	const bus_ctx *bus = &gb->bus;
+	switch (addr >> 12) {
+		case 0x0: case 0x1: case 0x2: case 0x3:
+		case 0x4: case 0x5: case 0x6: case 0x7:
+			return profile_bank_counters(gb, PROFILE_BANK_ROM, bus_rom_bank(gb, addr));
+		case 0x8: case 0x9:
+			return profile_bank_counters(gb, PROFILE_BANK_VRAM, bus->vram_bank);
+		case 0xA: case 0xB:
+			if (gb->mbc.ram_offset == MBC_RAM_UNMAPPED)
+				return NULL;
+			return profile_bank_counters(gb, PROFILE_BANK_RAM, gb->mbc.ram_offset / PROFILE_RAM_BANK_SIZE);
+		case 0xC: case 0xE:
+			return profile_bank_counters(gb, PROFILE_BANK_WRAM, 0);
+		case 0xD: case 0xF:
+			if (addr >= 0xFE00)
+				return NULL;
+			return profile_bank_counters(gb, PROFILE_BANK_WRAM, bus->wram_bank);
+	}
+	return NULL;
+}
+
+void profile_init(gbc_machine *gb) {
+	profile_context *ctx = &gb->profile;
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+void profile_enable(gbc_machine *gb, const char *csv_path) {
+	profile_context *ctx = &gb->profile;
+	ctx->enabled = true;
+	ctx->csv_path = csv_path;
+	bus_set_trap(gb, 0x0000, 0xFFFF, BUS_TRAP_PROFILE, true);
+	// cached instructions would skip the fetch counters
+	cpu_flush_decode_cache(gb);
+}
+
+void profile_access(gbc_machine *gb, profile_counter counter, u16 addr) {
+	profile_context *ctx = &gb->profile;
+	ctx->pages[BUS_PAGE(addr)][counter]++;
+	u64 *bank = profile_addr_bank(gb, addr);
+	if (bank)
+		bank[counter]++;
+}
+
+void profile_switch(gbc_machine *gb, profile_bank bank, u32 index) {
+	u64 *counters = profile_bank_counters(gb, bank, index);
+	if (counters)
+		counters[PROFILE_SWITCH]++;
+}
+
+static void profile_dump_rows(FILE *file, const char *kind, u64 (*rows)[PROFILE_COUNTER_COUNT], u32 count) {
+	for (u32 i = 0; i < count; i++) {
+		const u64 *row = rows[i];
+		if (!row[PROFILE_READ] && !row[PROFILE_WRITE] && !row[PROFILE_FETCH] && !row[PROFILE_SWITCH])
+			continue;
+		fprintf(file, "%s,%u,%llu,%llu,%llu,%llu\n", kind, i,
+			(unsigned long long)row[PROFILE_READ], (unsigned long long)row[PROFILE_WRITE],
+			(unsigned long long)row[PROFILE_FETCH], (unsigned long long)row[PROFILE_SWITCH]);
+	}
+}
+
+void profile_dump(gbc_machine *gb) {
+	profile_context *ctx = &gb->profile;
+	if (!ctx->enabled || !ctx->csv_path)
+		return;
+
+	FILE *file = fopen(ctx->csv_path, "w");
+	if (!file) {
+		fprintf(stderr, "ERR: failed to write profile %s\n", ctx->csv_path);
+		return;
+	}
+
+	// pages are indexed by address >> 8, banks by bank number
+	fprintf(file, "kind,index,reads,writes,fetches,switches\n");
+	profile_dump_rows(file, "page", ctx->pages, 0x100);
+	profile_dump_rows(file, "rom_bank", ctx->rom_banks, PROFILE_ROM_BANKS);
+	profile_dump_rows(file, "ram_bank", ctx->ram_banks, PROFILE_RAM_BANKS);
+	profile_dump_rows(file, "wram_bank", ctx->wram_banks, PROFILE_WRAM_BANKS);
+	profile_dump_rows(file, "vram_bank", ctx->vram_banks, PROFILE_VRAM_BANKS);
+	fclose(file);
+}
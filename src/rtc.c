@@ -0,0 +1,167 @@
+#include "rtc.h"
+#include "gbc.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+
+#define RTC_CYCLES_PER_SECOND 1048576
+#define RTC_DAY_SECONDS 86400
+// the day counter is 9 bits, overflowing it sets the carry flag
+#define RTC_WRAP_SECONDS (512 * RTC_DAY_SECONDS)
+
+#define RTC_DH_DAY_HI 0x01
+#define RTC_DH_HALT 0x40
+#define RTC_DH_CARRY 0x80
+
+static i64 rtc_now(gbc_machine *gb) {
+	rtc_context *ctx = &gb->rtc;
+	if (ctx->clock == RTC_CLOCK_CYCLES)
+		return cpu_get_ticks(gb) / RTC_CYCLES_PER_SECOND;
+	return (i64)time(NULL);
+}
+
+// seconds counted so far, folding day counter overflows into the carry
+static u64 rtc_counter(gbc_machine *gb) {
+	rtc_context *ctx = &gb->rtc;
+	if (ctx->halt)
+		return ctx->halted;
+
+	i64 now = rtc_now(gb);
+	if (now < ctx->base) {
+		// host clock went backwards
+		ctx->base = now;
+	}
+	u64 counter = now - ctx->base;
+	if (counter >= RTC_WRAP_SECONDS) {
+		ctx->carry = true;
+		ctx->base += (counter / RTC_WRAP_SECONDS) * RTC_WRAP_SECONDS;
+		counter %= RTC_WRAP_SECONDS;
+	}
+	return counter;
+}
+
+static void rtc_set_counter(gbc_machine *gb, u64 counter) {
+	rtc_context *ctx = &gb->rtc;
+	if (ctx->halt)
+		ctx->halted = counter;
+	else
+		ctx->base = rtc_now(gb) - (i64)counter;
+}
+
+static void rtc_regs(gbc_machine *gb, u8 regs[5]) {
+	rtc_context *ctx = &gb->rtc;
+	u64 counter = rtc_counter(gb);
+	u32 days = counter / RTC_DAY_SECONDS;
+	regs[0] = counter % 60;
+	regs[1] = counter / 60 % 60;
+	regs[2] = counter / 3600 % 24;
+	regs[3] = days & 0xFF;
+	regs[4] = ((days >> 8) & RTC_DH_DAY_HI) | (ctx->halt ? RTC_DH_HALT : 0) | (ctx->carry ? RTC_DH_CARRY : 0);
+}
+
+static u64 rtc_regs_counter(const u8 regs[5]) {
+	u64 days = regs[3] | ((regs[4] & RTC_DH_DAY_HI) << 8);
+	return days * RTC_DAY_SECONDS + (regs[2] & 0x1F) * 3600 + (regs[1] & 0x3F) * 60 + (regs[0] & 0x3F);
+}
+
+// restart the counter from the saved state, the wall clock also counts the
+// time the emulator was closed
+static void rtc_start(gbc_machine *gb) {
+	rtc_context *ctx = &gb->rtc;
+	u64 counter = ctx->save_counter;
+	if (ctx->clock == RTC_CLOCK_HOST && !ctx->halt && ctx->save_time) {
+		i64 elapsed = (i64)time(NULL) - ctx->save_time;
+		if (elapsed > 0)
+			counter += elapsed;
+	}
+	rtc_set_counter(gb, counter);
+}
+
+void rtc_init(gbc_machine *gb) {
+	rtc_context *ctx = &gb->rtc;
+	memset(ctx, 0, sizeof(*ctx));
+	rtc_start(gb);
+}
+
+void rtc_set_clock(gbc_machine *gb, rtc_clock clock) {
+	rtc_context *ctx = &gb->rtc;
+	ctx->clock = clock;
+	rtc_start(gb);
+}
+
+void rtc_latch(gbc_machine *gb, u8 val) {
+	rtc_context *ctx = &gb->rtc;
+	if (ctx->latch_prev == 0 && val == 1)
+		rtc_regs(gb, ctx->latched);
+	ctx->latch_prev = val;
+}
+
+u8 rtc_read(gbc_machine *gb, u8 reg) {
+	rtc_context *ctx = &gb->rtc;
+	if (reg < 0x8 || reg > 0xC)
+		return 0xFF;
+	return ctx->latched[reg - 0x8];
+}
+
+void rtc_write(gbc_machine *gb, u8 reg, u8 val) {
+	rtc_context *ctx = &gb->rtc;
+	if (reg < 0x8 || reg > 0xC)
+		return;
+
+	u8 regs[5];
+	rtc_regs(gb, regs);
+	regs[reg - 0x8] = val;
+	ctx->latched[reg - 0x8] = val;
+
+	// halt and carry come from the written flags, the counter is rebased on
+	// the new register values
+	ctx->halt = regs[4] & RTC_DH_HALT;
+	ctx->carry = regs[4] & RTC_DH_CARRY;
+	rtc_set_counter(gb, rtc_regs_counter(regs));
+}
+
+static u32 rtc_get32(const u8 *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static void rtc_put32(u8 *p, u32 val) {
+	for (u32 i = 0; i < 4; i++)
+		p[i] = val >> (i * 8);
+}
+
+void rtc_load(gbc_machine *gb, const u8 *data, u32 size) {
+	rtc_context *ctx = &gb->rtc;
+	// some emulators write a 32-bit timestamp (44 bytes)
+	if (size < RTC_SAVE_SIZE - 4)
+		return;
+
+	u8 regs[5];
+	for (u32 i = 0; i < 5; i++) {
+		regs[i] = rtc_get32(data + i * 4);
+		ctx->latched[i] = rtc_get32(data + 20 + i * 4);
+	}
+	u64 timestamp = rtc_get32(data + 40);
+	if (size >= RTC_SAVE_SIZE)
+		timestamp |= (u64)rtc_get32(data + 44) << 32;
+
+	ctx->halt = regs[4] & RTC_DH_HALT;
+	ctx->carry = regs[4] & RTC_DH_CARRY;
+	ctx->save_counter = rtc_regs_counter(regs);
+	ctx->save_time = (i64)timestamp;
+	rtc_start(gb);
+}
+
+void rtc_save(gbc_machine *gb, u8 data[RTC_SAVE_SIZE]) {
+	rtc_context *ctx = &gb->rtc;
+	u8 regs[5];
+	rtc_regs(gb, regs);
+	for (u32 i = 0; i < 5; i++) {
+		rtc_put32(data + i * 4, regs[i]);
+		rtc_put32(data + 20 + i * 4, ctx->latched[i]);
+	}
+	u64 timestamp = (u64)time(NULL);
+	rtc_put32(data + 40, timestamp);
+	rtc_put32(data + 44, timestamp >> 32);
+}
@@ -0,0 +1,111 @@
+#include "scheduler.h"
+#include "gbc.h"
+
+#include <string.h>
+
+#include "cpu.h"
+
+
+static void scheduler_swap(gbc_machine *gb, int a, int b) {
+	scheduler_context *ctx = &gb->scheduler;
+	sched_event t = ctx->heap[a];
+	ctx->heap[a] = ctx->heap[b];
+	ctx->heap[b] = t;
+	ctx->pos[ctx->heap[a]] = a;
+	ctx->pos[ctx->heap[b]] = b;
+}
+
+static void scheduler_sift_up(gbc_machine *gb, int i) {
+	scheduler_context *ctx = &gb->scheduler;
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (ctx->when[ctx->heap[parent]] <= ctx->when[ctx->heap[i]])
+			break;
+		scheduler_swap(gb, i, parent);
+		i = parent;
+	}
+}
+
+static void scheduler_sift_down(gbc_machine *gb, int i) {
+	scheduler_context *ctx = &gb->scheduler;
+	for (;;) {
+		int l = i * 2 + 1, r = l + 1, min = i;
+		if (l < ctx->count && ctx->when[ctx->heap[l]] < ctx->when[ctx->heap[min]])
+			min = l;
+		if (r < ctx->count && ctx->when[ctx->heap[r]] < ctx->when[ctx->heap[min]])
+			min = r;
+		if (min == i)
+			break;
+		scheduler_swap(gb, i, min);
+		i = min;
+	}
+}
+
+void scheduler_init(gbc_machine *gb) {
+	scheduler_context *ctx = &gb->scheduler;
+	memset(ctx, 0, sizeof(*ctx));
+	for (int i = 0; i < SCHED_EVENT_COUNT; i++)
+		ctx->pos[i] = -1;
+}
+
+void scheduler_register(gbc_machine *gb, sched_event event, sched_callback callback) {
+	scheduler_context *ctx = &gb->scheduler;
+	ctx->callbacks[event] = callback;
+}
+
+void scheduler_schedule(gbc_machine *gb, sched_event event, u64 cycle) {
+	scheduler_context *ctx = &gb->scheduler;
+	u64 next = scheduler_next(gb);
+
+	ctx->when[event] = cycle;
+	int i = ctx->pos[event];
+	if (i < 0) {
+		i = ctx->count++;
+		ctx->heap[i] = event;
+		ctx->pos[event] = i;
+	}
+	scheduler_sift_up(gb, i);
+	scheduler_sift_down(gb, ctx->pos[event]);
+
+	// the cpu may be running towards a later event, let it stop in time
+	if (cycle < next)
+		cpu_yield(gb);
+}
+
+void scheduler_cancel(gbc_machine *gb, sched_event event) {
+	scheduler_context *ctx = &gb->scheduler;
+	int i = ctx->pos[event];
+	if (i < 0)
+		return;
+
+	ctx->pos[event] = -1;
+	if (i == --ctx->count)
+		return;
+
+	sched_event moved = ctx->heap[ctx->count];
+	ctx->heap[i] = moved;
+	ctx->pos[moved] = i;
+	scheduler_sift_up(gb, i);
+	scheduler_sift_down(gb, ctx->pos[moved]);
+}
+
+bool scheduler_pending(gbc_machine *gb, sched_event event) {
+	scheduler_context *ctx = &gb->scheduler;
+	return ctx->pos[event] >= 0;
+}
+
+u64 scheduler_next(gbc_machine *gb) {
+	scheduler_context *ctx = &gb->scheduler;
+	return ctx->count ? ctx->when[ctx->heap[0]] : SCHED_NEVER;
+}
+
+void scheduler_run(gbc_machine *gb, u64 now) {
+	scheduler_context *ctx = &gb->scheduler;
+	while (ctx->count && ctx->when[ctx->heap[0]] <= now) {
+		sched_event event = ctx->heap[0];
+		u64 when = ctx->when[event];
+		scheduler_cancel(gb, event);
+		if (ctx->callbacks[event])
+			ctx->callbacks[event](gb, when);
+	}
+}
@@ -0,0 +1,56 @@
+#include "serial.h"
+#include "gbc.h"
+
+#include "bus.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "scheduler.h"
+
+// 8192 Hz internal clock, 8 bits per transfer
+#define SERIAL_TRANSFER_CYCLES (128 * 8)
+
+
+static void serial_event(gbc_machine *gb, u64 cycle) {
+	serial_context *ctx = &gb->serial;
+	// no link partner, shift in all ones
+	ctx->sb = 0xFF;
+	ctx->sc &= 0x7F;
+	cpu_request_interrupt(gb, INTERRUPT_SERIAL);
+}
+
+u8 serial_read(gbc_machine *gb, u16 addr) {
+	serial_context *ctx = &gb->serial;
+	switch (addr) {
+		case ADDR_SB:
+			return ctx->sb;
+		case ADDR_SC:
+			return ctx->sc | 0x7E;
+	}
+	return 0xFF;
+}
+
+void serial_write(gbc_machine *gb, u16 addr, u8 val) {
+	serial_context *ctx = &gb->serial;
+	switch (addr) {
+		case ADDR_SB:
+			ctx->sb = val;
+		break;
+		case ADDR_SC:
+			ctx->sc = val;
+			// transfer start with internal clock, external clock never completes
+			if ((val & 0x81) == 0x81)
+				scheduler_schedule(gb, SCHED_SERIAL, cpu_get_ticks(gb) + SERIAL_TRANSFER_CYCLES);
+			else
+				scheduler_cancel(gb, SCHED_SERIAL);
+		break;
+	}
+}
+
+void serial_init(gbc_machine *gb) {
+	serial_context *ctx = &gb->serial;
+	ctx->sb = 0;
+	ctx->sc = 0;
+	scheduler_register(gb, SCHED_SERIAL, serial_event);
+	bus_register_io(gb, ADDR_SB, serial_read, serial_write);
+	bus_register_io(gb, ADDR_SC, serial_read, serial_write);
+}
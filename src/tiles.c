@@ -0,0 +1,33 @@
+#include "tiles.h"
+#include "gbc.h"
+
+#include <string.h>
+
+#include "bus.h"
+
+#define TILES_DATA_START 0x8000
+#define TILES_DATA_END 0x97FF
+#define TILES_VRAM_BANK_SIZE 0x2000
+
+void tiles_init(gbc_machine *gb) {
+	tiles_context *ctx = &gb->tiles;
+	// vram starts cleared, which decodes to all zero
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->kernels = pixel_get_kernels();
+	bus_set_trap(gb, TILES_DATA_START, TILES_DATA_END, BUS_TRAP_TILES, true);
+}
+
+void tiles_write(gbc_machine *gb, u16 addr, u32 len) {
+	tiles_context *ctx = &gb->tiles;
+	u32 bank = gb->bus.vram_bank;
+	u32 start = addr - TILES_DATA_START;
+	u32 end = start + len;
+	if (end > TILES_DATA_END + 1 - TILES_DATA_START)
+		end = TILES_DATA_END + 1 - TILES_DATA_START;
+	// rows are two bytes, redecode each touched row once; the cache keeps
+	// rows in vram order so a whole range is one kernel call
+	u32 row = bank * TILES_PER_BANK * 8 + start / 2;
+	u32 rows = (end + 1) / 2 - start / 2;
+	const u8 *data = gb->bus.vram + bank * TILES_VRAM_BANK_SIZE + (start & ~1);
+	ctx->kernels->decode(data, rows, PIXEL_PALETTE_IDENTITY, ctx->pixels[0][0] + row * 8, ctx->flipped[0][0] + row * 8);
+}
@@ -1,76 +1,133 @@
 #include "timer.h"
+#include "gbc.h"
 #include <stdio.h>
 
-typedef struct {
-	u32 div;
-	u8 tima;
-	u8 tma;
-	u8 tac;
-} timer_context;
+#include "bus.h"
+#include "cpu.h"
+#include "interrupt.h"
+#include "scheduler.h"
 
-static timer_context ctx = {0};
+static u64 timer_counter(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	return cpu_get_ticks(gb) * 4 + ctx->div_offset;
+}
+
+static bool timer_enabled(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	 // bit 2 for tima enable flag
+	return ctx->tac & 0x4;
+}
+
+// div counter increments between two tima increments
+static u64 timer_period(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	switch (ctx->tac & 0x3) {
+		case 0x0: return 1 << 10;
+		case 0x1: return 1 << 4;
+		case 0x2: return 1 << 6;
+		default: return 1 << 8;
+	}
+}
+
+// the signal whose falling edge increments tima
+static bool timer_signal(gbc_machine *gb, u64 counter) {
+	return timer_enabled(gb) && (counter & (timer_period(gb) >> 1));
+}
+
+static void timer_increment(gbc_machine *gb, u64 n) {
+	timer_context *ctx = &gb->timer;
+	u32 room = 0x100 - ctx->tima;
+	if (n >= room) {
+		n -= room;
+		ctx->tima = ctx->tma;
+		cpu_request_interrupt(gb, INTERRUPT_TIMER);
+		n %= 0x100 - ctx->tma;
+	}
+	ctx->tima += n;
+}
 
-u8 timer_read(u16 addr) {
+// bring tima up to the current cycle
+static void timer_sync(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	u64 counter = timer_counter(gb);
+	if (timer_enabled(gb)) {
+		u64 period = timer_period(gb);
+		timer_increment(gb, counter / period - ctx->tima_counter / period);
+	}
+	ctx->tima_counter = counter;
+}
+
+// predict the cycle tima overflows at
+static void timer_schedule(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	if (!timer_enabled(gb)) {
+		scheduler_cancel(gb, SCHED_TIMER);
+		return;
+	}
+
+	u64 period = timer_period(gb);
+	u64 counter = timer_counter(gb);
+	u64 overflow = (counter / period + (0x100 - ctx->tima)) * period;
+	scheduler_schedule(gb, SCHED_TIMER, cpu_get_ticks(gb) + (overflow - counter + 3) / 4);
+}
+
+static void timer_event(gbc_machine *gb, u64 cycle) {
+	timer_sync(gb);
+	timer_schedule(gb);
+}
+
+u8 timer_read(gbc_machine *gb, u16 addr) {
+	timer_context *ctx = &gb->timer;
 	switch (addr) {
 		case ADDR_DIV:
-			return (ctx.div & 0xFF) >> 8;
+			return (timer_counter(gb) >> 8) & 0xFF;
 		case ADDR_TIMA:
-			return ctx.tima;
+			timer_sync(gb);
+			return ctx->tima;
 		case ADDR_TMA:
-			return ctx.tma;
+			return ctx->tma;
 		case ADDR_TAC:
-			return ctx.tac;
+			return ctx->tac;
 	}
 	return 0;
 }
 
-void timer_write(u16 addr, u8 val) {
+void timer_write(gbc_machine *gb, u16 addr, u8 val) {
+	timer_context *ctx = &gb->timer;
+	timer_sync(gb);
+	bool signal = timer_signal(gb, ctx->tima_counter);
+
 	switch (addr) {
 		case ADDR_DIV:
-			ctx.div = 0;
+			ctx->div_offset = -(cpu_get_ticks(gb) * 4);
+			ctx->tima_counter = 0;
 		break;
 		case ADDR_TIMA:
-			ctx.tima = val;
+			ctx->tima = val;
 		break;
 		case ADDR_TMA:
-			ctx.tma = val;
+			ctx->tma = val;
 		break;
 		case ADDR_TAC:
-			ctx.tac = val;
+			ctx->tac = val;
 		break;
 	}
-}
 
-bool timer_tick() {
-	u32 p_div = ctx.div++;
-	bool timer_update = false;
-	switch (ctx.tac & 0x3) {
-		case 0x0:
-			timer_update = (p_div & (1 << 9)) && !(ctx.div & (1 << 9));
-		break;
-		case 0x1:
-			timer_update = (p_div & (1 << 3)) && !(ctx.div & (1 << 3));
-		break;
-		case 0x2:
-			timer_update = (p_div & (1 << 5)) && !(ctx.div & (1 << 5));
-		break;
-		case 0x3:
-			timer_update = (p_div & (1 << 7)) && !(ctx.div & (1 << 7));
-		break;
-	}
-
-	 // bit 2 for tima enable flag
-	if ((ctx.tac & 0x4) && timer_update) {
-		ctx.tima++;
-		if (ctx.tima == 0xFF) {
-			ctx.tima = ctx.tma;
-			return true;
-		}
-	}
+	// resetting div or changing tac can produce a falling edge by itself
+	if (signal && !timer_signal(gb, ctx->tima_counter))
+		timer_increment(gb, 1);
 
-	return false;
+	timer_schedule(gb);
 }
 
-void timer_init() {
-	ctx.div = 0xAC00;
+void timer_init(gbc_machine *gb) {
+	timer_context *ctx = &gb->timer;
+	ctx->div_offset = 0xAC00 - cpu_get_ticks(gb) * 4;
+	ctx->tima_counter = timer_counter(gb);
+	scheduler_register(gb, SCHED_TIMER, timer_event);
+	bus_register_io(gb, ADDR_DIV, timer_read, timer_write);
+	bus_register_io(gb, ADDR_TIMA, timer_read, timer_write);
+	bus_register_io(gb, ADDR_TMA, timer_read, timer_write);
+	bus_register_io(gb, ADDR_TAC, timer_read, timer_write);
+	timer_schedule(gb);
 }
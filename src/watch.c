@@ -0,0 +1,98 @@
+#include "watch.h"
+#include "gbc.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "bus.h"
+#include "cpu.h"
+
+static const u8 watch_traps[] = {
+	[WATCH_READ] = BUS_TRAP_WATCH_READ,
+	[WATCH_WRITE] = BUS_TRAP_WATCH_WRITE,
+	[WATCH_EXEC] = BUS_TRAP_WATCH_EXEC,
+};
+
+// recompute the trapped pages from all watchpoints, ranges may share pages
+static void watch_update_traps(gbc_machine *gb) {
+	watch_context *ctx = &gb->watch;
+	bus_set_trap(gb, 0x0000, 0xFFFF, BUS_TRAP_WATCH_READ | BUS_TRAP_WATCH_WRITE | BUS_TRAP_WATCH_EXEC, false);
+	for (u32 i = 0; i < WATCH_MAX; i++) {
+		watch_range *range = &ctx->ranges[i];
+		for (u8 kind = WATCH_READ; kind <= WATCH_EXEC; kind <<= 1) {
+			if (range->kinds & kind)
+				bus_set_trap(gb, range->start, range->end, watch_traps[kind], true);
+		}
+	}
+}
+
+static void watch_log(gbc_machine *gb, const watch_hit *hit, void *user) {
+	static const char *kind_names[] = { [WATCH_READ] = "read", [WATCH_WRITE] = "write", [WATCH_EXEC] = "exec" };
+	fprintf(stderr, "watch: %-5s %04X = %02X pc %04X cycle %llu\n",
+		kind_names[hit->kind], hit->addr, hit->val, hit->pc, (unsigned long long)hit->cycle);
+}
+
+void watch_init(gbc_machine *gb) {
+	watch_context *ctx = &gb->watch;
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->callback = watch_log;
+}
+
+int watch_add(gbc_machine *gb, u16 start, u16 end, u8 kinds) {
+	watch_context *ctx = &gb->watch;
+	kinds &= WATCH_READ | WATCH_WRITE | WATCH_EXEC;
+	if (!kinds || end < start)
+		return -1;
+
+	for (int i = 0; i < WATCH_MAX; i++) {
+		watch_range *range = &ctx->ranges[i];
+		if (range->kinds)
+			continue;
+
+		range->start = start;
+		range->end = end;
+		range->kinds = kinds;
+		watch_update_traps(gb);
+		// cached rom instructions never reach the bus again
+		if (kinds & WATCH_EXEC)
+			cpu_flush_decode_cache(gb);
+		return i;
+	}
+
+	fprintf(stderr, "ERR: no free watchpoint for %04X-%04X\n", start, end);
+	return -1;
+}
+
+void watch_remove(gbc_machine *gb, int id) {
+	watch_context *ctx = &gb->watch;
+	if (id < 0 || id >= WATCH_MAX)
+		return;
+	ctx->ranges[id].kinds = 0;
+	watch_update_traps(gb);
+}
+
+void watch_set_callback(gbc_machine *gb, watch_callback callback, void *user) {
+	watch_context *ctx = &gb->watch;
+	ctx->callback = callback ? callback : watch_log;
+	ctx->user = user;
+}
+
+void watch_check(gbc_machine *gb, watch_kind kind, u16 addr, u8 val) {
+	watch_context *ctx = &gb->watch;
+	for (u32 i = 0; i < WATCH_MAX; i++) {
+		const watch_range *range = &ctx->ranges[i];
+		if (!(range->kinds & kind) || addr < range->start || addr > range->end)
+			continue;
+
+		watch_hit hit = {
+			.kind = kind,
+			.addr = addr,
+			// an instruction being fetched is not the current one yet
+			.pc = kind == WATCH_EXEC ? addr : cpu_instruction_pc(gb),
+			.val = val,
+			.cycle = cpu_get_ticks(gb),
+		};
+		ctx->callback(gb, &hit, ctx->user);
+		return;
+	}
+}